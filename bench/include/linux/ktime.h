@@ -0,0 +1 @@
+#include "../../kshim.h"
@@ -0,0 +1 @@
+/* Tracepoints are already defined by TRACE_EVENT in kshim.h. */
@@ -0,0 +1,904 @@
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "kshim.h"
+#include "v2d_model.h"
+
+#define DMA_BASE	0x10000000u
+#define DMA_PAGES	65536
+#define MAX_FILES	1024
+#define MAX_CDEVS	16
+#define MAX_MODELS	16
+#define MAX_DENTRIES	4096
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* dma ***********************************************************************/
+static uint8_t *arena;
+static struct page pages[DMA_PAGES];
+static unsigned free_pages[DMA_PAGES];
+static unsigned free_count;
+
+static void
+arena_init(void)
+{
+	unsigned i;
+
+	arena = mmap(NULL, (size_t) DMA_PAGES * PAGE_SIZE,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS
+			| MAP_NORESERVE, -1, 0);
+	if (arena == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	for (i = 0; i < DMA_PAGES; ++i)
+		free_pages[i] = DMA_PAGES - 1 - i;
+	free_count = DMA_PAGES;
+}
+
+void *
+dma_alloc_coherent(struct device *dev, size_t size, dma_addr_t *handle,
+		gfp_t gfp)
+{
+	unsigned page;
+
+	if (size > PAGE_SIZE)
+		return NULL;
+	pthread_mutex_lock(&lock);
+	if (!arena)
+		arena_init();
+	if (free_count == 0) {
+		pthread_mutex_unlock(&lock);
+		return NULL;
+	}
+	page = free_pages[--free_count];
+	pages[page].nid = 0;
+	pthread_mutex_unlock(&lock);
+	*handle = DMA_BASE + page * PAGE_SIZE;
+	return arena + (size_t) page * PAGE_SIZE;
+}
+
+struct page *
+alloc_pages_node(int node, gfp_t gfp, unsigned order)
+{
+	dma_addr_t handle;
+	void *addr;
+	struct page *page;
+
+	if (order)
+		return NULL;
+	addr = dma_alloc_coherent(NULL, PAGE_SIZE, &handle, gfp);
+	if (!addr)
+		return NULL;
+	if (gfp & __GFP_ZERO)
+		memset(addr, 0, PAGE_SIZE);
+	page = &pages[(handle - DMA_BASE) / PAGE_SIZE];
+	page->nid = node;
+	return page;
+}
+
+void
+__free_page(struct page *page)
+{
+	dma_free_coherent(NULL, PAGE_SIZE, page_address(page),
+			dma_map_page(NULL, page, 0, PAGE_SIZE, 0));
+}
+
+void *
+page_address(struct page *page)
+{
+	return arena + (size_t) (page - pages) * PAGE_SIZE;
+}
+
+dma_addr_t
+dma_map_page(struct device *dev, struct page *page, size_t offset,
+		size_t size, int dir)
+{
+	return DMA_BASE + (page - pages) * PAGE_SIZE + offset;
+}
+
+void
+dma_free_coherent(struct device *dev, size_t size, void *addr,
+		dma_addr_t handle)
+{
+	pthread_mutex_lock(&lock);
+	free_pages[free_count++] = (handle - DMA_BASE) / PAGE_SIZE;
+	pthread_mutex_unlock(&lock);
+}
+
+void *
+kshim_dma_to_virt(dma_addr_t handle)
+{
+	return arena + (handle - DMA_BASE);
+}
+
+unsigned long
+kshim_pa(void *addr)
+{
+	return DMA_BASE + ((uint8_t *) addr - arena);
+}
+
+struct page *
+kshim_pfn_to_page(unsigned long pfn)
+{
+	return &pages[pfn - DMA_BASE / PAGE_SIZE];
+}
+
+unsigned long
+kshim_page_to_pfn(struct page *page)
+{
+	return DMA_BASE / PAGE_SIZE + (page - pages);
+}
+
+/* rcu and ida ***************************************************************/
+pthread_rwlock_t kshim_rcu = PTHREAD_RWLOCK_INITIALIZER;
+
+void
+ida_init(struct ida *ida)
+{
+	pthread_mutex_init(&ida->lock, NULL);
+	memset(ida->used, 0, sizeof(ida->used));
+}
+
+int
+ida_simple_get(struct ida *ida, unsigned start, unsigned end, gfp_t gfp)
+{
+	unsigned id;
+
+	if (end == 0 || end > KSHIM_IDA_SIZE)
+		end = KSHIM_IDA_SIZE;
+	pthread_mutex_lock(&ida->lock);
+	for (id = start; id < end; ++id)
+		if (!test_bit(id, ida->used)) {
+			ida->used[id / BITS_PER_LONG] |=
+				1UL << (id % BITS_PER_LONG);
+			pthread_mutex_unlock(&ida->lock);
+			return id;
+		}
+	pthread_mutex_unlock(&ida->lock);
+	return -ENOSPC;
+}
+
+void
+ida_simple_remove(struct ida *ida, unsigned id)
+{
+	pthread_mutex_lock(&ida->lock);
+	clear_bit(id, ida->used);
+	pthread_mutex_unlock(&ida->lock);
+}
+
+/* files *********************************************************************/
+static struct file *files[MAX_FILES];
+
+static int
+install_file(struct file *file)
+{
+	int fd;
+
+	pthread_mutex_lock(&lock);
+	for (fd = 0; fd < MAX_FILES; ++fd)
+		if (!files[fd]) {
+			files[fd] = file;
+			pthread_mutex_unlock(&lock);
+			return fd;
+		}
+	pthread_mutex_unlock(&lock);
+	return -EMFILE;
+}
+
+static struct file *
+lookup_file(int fd)
+{
+	struct file *file = NULL;
+
+	pthread_mutex_lock(&lock);
+	if (fd >= 0 && fd < MAX_FILES && files[fd]) {
+		file = files[fd];
+		++file->f_count;
+	}
+	pthread_mutex_unlock(&lock);
+	return file;
+}
+
+struct fd
+fdget(int fd)
+{
+	struct fd f = { lookup_file(fd) };
+
+	return f;
+}
+
+void
+fdput(struct fd f)
+{
+	if (f.file)
+		fput(f.file);
+}
+
+struct file *
+get_file(struct file *f)
+{
+	pthread_mutex_lock(&lock);
+	++f->f_count;
+	pthread_mutex_unlock(&lock);
+	return f;
+}
+
+void
+fput(struct file *f)
+{
+	int count;
+
+	pthread_mutex_lock(&lock);
+	count = --f->f_count;
+	pthread_mutex_unlock(&lock);
+	if (count == 0) {
+		if (f->f_op->release)
+			f->f_op->release(f->f_inode, f);
+		free(f);
+	}
+}
+
+struct file *
+anon_inode_getfile(const char *name, const struct file_operations *fops,
+		void *priv, int flags)
+{
+	static struct inode anon_inode;
+	struct file *file = calloc(1, sizeof(struct file));
+
+	if (!file)
+		return ERR_PTR(-ENOMEM);
+	file->f_op = fops;
+	file->private_data = priv;
+	file->f_inode = &anon_inode;
+	file->f_mapping = &anon_inode.i_data;
+	file->f_flags = flags;
+	file->f_count = 1;
+	return file;
+}
+
+int
+anon_inode_getfd(const char *name, const struct file_operations *fops,
+		void *priv, int flags)
+{
+	struct file *file = anon_inode_getfile(name, fops, priv, flags);
+	int fd;
+
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+	fd = install_file(file);
+	if (fd < 0)
+		free(file);
+	return fd;
+}
+
+/* Holds a descriptor until fd_install. */
+static struct file reserved_file;
+
+int
+get_unused_fd_flags(unsigned flags)
+{
+	return install_file(&reserved_file);
+}
+
+void
+put_unused_fd(int fd)
+{
+	pthread_mutex_lock(&lock);
+	files[fd] = NULL;
+	pthread_mutex_unlock(&lock);
+}
+
+void
+fd_install(int fd, struct file *file)
+{
+	pthread_mutex_lock(&lock);
+	files[fd] = file;
+	pthread_mutex_unlock(&lock);
+}
+
+loff_t
+fixed_size_llseek(struct file *file, loff_t offset, int whence, loff_t size)
+{
+	return whence == SEEK_SET ? offset : whence == SEEK_END
+		? size + offset : -EINVAL;
+}
+
+static struct cdev *cdevs[MAX_CDEVS];
+static struct inode cdev_inodes[MAX_CDEVS];
+
+struct cdev *
+cdev_alloc(void)
+{
+	return calloc(1, sizeof(struct cdev));
+}
+
+void
+cdev_init(struct cdev *cdev, const struct file_operations *fops)
+{
+	cdev->ops = fops;
+}
+
+int
+cdev_add(struct cdev *cdev, dev_t dev, unsigned count)
+{
+	int i;
+
+	cdev->dev = dev;
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < MAX_CDEVS; ++i)
+		if (!cdevs[i]) {
+			cdevs[i] = cdev;
+			cdev_inodes[i].i_rdev = dev;
+			pthread_mutex_unlock(&lock);
+			return 0;
+		}
+	pthread_mutex_unlock(&lock);
+	return -ENOMEM;
+}
+
+void
+cdev_del(struct cdev *cdev)
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < MAX_CDEVS; ++i)
+		if (cdevs[i] == cdev)
+			cdevs[i] = NULL;
+	pthread_mutex_unlock(&lock);
+	free(cdev);
+}
+
+int
+alloc_chrdev_region(dev_t *dev, unsigned first, unsigned count,
+		const char *name)
+{
+	*dev = MKDEV(250, first);
+	return 0;
+}
+
+void
+unregister_chrdev_region(dev_t dev, unsigned count)
+{
+}
+
+struct class *
+class_create(struct module *owner, const char *name)
+{
+	static struct class class;
+
+	return &class;
+}
+
+void
+class_destroy(struct class *class)
+{
+}
+
+struct device *
+device_create(struct class *class, struct device *parent, dev_t devt,
+		void *data, const char *fmt, ...)
+{
+	struct device *device = calloc(1, sizeof(struct device));
+	va_list args;
+
+	if (!device)
+		return (struct device *) (long) -ENOMEM;
+	va_start(args, fmt);
+	vsnprintf(device->name, sizeof(device->name), fmt, args);
+	va_end(args);
+	return device;
+}
+
+void
+device_destroy(struct class *class, dev_t devt)
+{
+}
+
+/* time and debugfs *********************************************************/
+u64
+ktime_get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The clock of pthread_cond_timedwait. */
+u64
+ktime_get_real_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct dentry *dentries[MAX_DENTRIES];
+
+static struct dentry *
+create_dentry(const char *name, struct dentry *parent, void *data,
+		const struct file_operations *fops)
+{
+	struct dentry *dentry = calloc(1, sizeof(struct dentry));
+	int i;
+
+	if (!dentry)
+		return NULL;
+	snprintf(dentry->name, sizeof(dentry->name), "%s", name);
+	dentry->parent = parent;
+	dentry->data = data;
+	dentry->fops = fops;
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < MAX_DENTRIES; ++i)
+		if (!dentries[i]) {
+			dentries[i] = dentry;
+			break;
+		}
+	pthread_mutex_unlock(&lock);
+	return dentry;
+}
+
+struct dentry *
+debugfs_create_dir(const char *name, struct dentry *parent)
+{
+	return create_dentry(name, parent, NULL, NULL);
+}
+
+struct dentry *
+debugfs_create_file(const char *name, unsigned mode, struct dentry *parent,
+		void *data, const struct file_operations *fops)
+{
+	return create_dentry(name, parent, data, fops);
+}
+
+static bool
+descends(struct dentry *dentry, struct dentry *ancestor)
+{
+	for (; dentry; dentry = dentry->parent)
+		if (dentry == ancestor)
+			return true;
+	return false;
+}
+
+/* Removed entries are kept, since their children may still point to them. */
+void
+debugfs_remove(struct dentry *dentry)
+{
+	if (dentry)
+		dentry->removed = true;
+}
+
+void
+debugfs_remove_recursive(struct dentry *dentry)
+{
+	int i;
+
+	if (!dentry)
+		return;
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < MAX_DENTRIES; ++i)
+		if (dentries[i] && descends(dentries[i], dentry))
+			dentries[i]->removed = true;
+	pthread_mutex_unlock(&lock);
+}
+
+static bool
+has_path(struct dentry *dentry, const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char parent[256];
+
+	if (!slash)
+		return !dentry->parent && !strcmp(dentry->name, path);
+	if (!dentry->parent || strcmp(dentry->name, slash + 1)
+			|| (size_t) (slash - path) >= sizeof(parent))
+		return false;
+	memcpy(parent, path, slash - path);
+	parent[slash - path] = '\0';
+	return has_path(dentry->parent, parent);
+}
+
+int
+single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data)
+{
+	struct seq_file *seq = calloc(1, sizeof(struct seq_file));
+
+	if (!seq)
+		return -ENOMEM;
+	seq->private = data;
+	seq->show = show;
+	file->private_data = seq;
+	return 0;
+}
+
+int
+single_release(struct inode *inode, struct file *file)
+{
+	free(file->private_data);
+	return 0;
+}
+
+int
+seq_open(struct file *file, const struct seq_operations *op)
+{
+	struct seq_file *seq = calloc(1, sizeof(struct seq_file));
+
+	if (!seq)
+		return -ENOMEM;
+	seq->op = op;
+	file->private_data = seq;
+	return 0;
+}
+
+int
+kshim_debugfs_print(const char *path, FILE *out)
+{
+	struct dentry *dentry = NULL;
+	struct inode inode = { 0 };
+	struct file file = { 0 };
+	struct seq_file *seq;
+	loff_t pos = 0;
+	void *v;
+	int i, ret = 0;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < MAX_DENTRIES; ++i)
+		if (dentries[i] && !dentries[i]->removed && dentries[i]->fops
+				&& has_path(dentries[i], path))
+			dentry = dentries[i];
+	pthread_mutex_unlock(&lock);
+	if (!dentry)
+		return -ENOENT;
+	inode.i_private = dentry->data;
+	file.f_inode = &inode;
+	file.f_op = dentry->fops;
+	ret = dentry->fops->open(&inode, &file);
+	if (ret)
+		return ret;
+	seq = file.private_data;
+	seq->out = out;
+	if (seq->op) {
+		/* The whole file is read at once. */
+		v = seq->op->start(seq, &pos);
+		while (v && !ret) {
+			ret = seq->op->show(seq, v);
+			v = seq->op->next(seq, v, &pos);
+		}
+		seq->op->stop(seq, v);
+	} else {
+		ret = seq->show(seq, NULL);
+	}
+	dentry->fops->release(&inode, &file);
+	return ret;
+}
+
+/* pci ***********************************************************************/
+static struct pci_driver *driver;
+static v2d_model_t *models[MAX_MODELS];
+static struct pci_dev pci_devs[MAX_MODELS];
+
+int
+pci_register_driver(struct pci_driver *drv)
+{
+	driver = drv;
+	return 0;
+}
+
+void
+pci_unregister_driver(struct pci_driver *drv)
+{
+	kshim_remove_devices();
+	driver = NULL;
+}
+
+void __iomem *
+pci_iomap(struct pci_dev *dev, int bar, unsigned long max)
+{
+	return models[dev->irq - 1]->mmio;
+}
+
+int
+request_irq(unsigned irq, irq_handler_t handler, unsigned long flags,
+		const char *name, void *dev_id)
+{
+	v2d_model_t *model = models[irq - 1];
+
+	pthread_mutex_lock(&model->lock);
+	model->irq_handler = handler;
+	model->irq_dev = dev_id;
+	pthread_mutex_unlock(&model->lock);
+	return 0;
+}
+
+void
+free_irq(unsigned irq, void *dev_id)
+{
+	v2d_model_t *model = models[irq - 1];
+
+	pthread_mutex_lock(&model->lock);
+	model->irq_handler = NULL;
+	pthread_mutex_unlock(&model->lock);
+}
+
+static v2d_model_t *
+model_of(void __iomem *addr, unsigned *offset)
+{
+	int i;
+
+	for (i = 0; i < MAX_MODELS; ++i)
+		if (models[i] && (char *) addr >= models[i]->mmio
+				&& (char *) addr < models[i]->mmio
+					+ V2D_MODEL_REGS) {
+			*offset = (char *) addr - models[i]->mmio;
+			return models[i];
+		}
+	fprintf(stderr, "kshim: access outside of the registers\n");
+	abort();
+}
+
+unsigned
+ioread32(void __iomem *addr)
+{
+	unsigned offset;
+	v2d_model_t *model = model_of(addr, &offset);
+
+	return v2d_model_read(model, offset);
+}
+
+void
+iowrite32(unsigned value, void __iomem *addr)
+{
+	unsigned offset;
+	v2d_model_t *model = model_of(addr, &offset);
+
+	v2d_model_write(model, offset, value);
+}
+
+/* harness *******************************************************************/
+int
+kshim_add_device(v2d_model_t *model)
+{
+	static const struct pci_device_id id = { 0, 0 };
+	int i;
+
+	for (i = 0; i < MAX_MODELS; ++i)
+		if (!models[i]) {
+			models[i] = model;
+			pci_devs[i].irq = i + 1;
+			if (v2d_model_start(model, i + 1)
+					|| driver->probe(&pci_devs[i], &id)) {
+				models[i] = NULL;
+				return -1;
+			}
+			return 0;
+		}
+	return -1;
+}
+
+void
+kshim_remove_devices(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_MODELS; ++i)
+		if (models[i]) {
+			driver->remove(&pci_devs[i]);
+			v2d_model_stop(models[i]);
+			models[i] = NULL;
+		}
+}
+
+int
+kshim_open(unsigned minor)
+{
+	struct file *file;
+	int i, fd, ret;
+
+	for (i = 0; i < MAX_CDEVS; ++i)
+		if (cdevs[i] && MINOR(cdevs[i]->dev) == minor)
+			break;
+	if (i == MAX_CDEVS)
+		return -ENODEV;
+	file = calloc(1, sizeof(struct file));
+	if (!file)
+		return -ENOMEM;
+	file->f_op = cdevs[i]->ops;
+	file->f_inode = &cdev_inodes[i];
+	file->f_mapping = &cdev_inodes[i].i_data;
+	file->f_flags = O_RDWR;
+	file->f_count = 1;
+	ret = file->f_op->open(file->f_inode, file);
+	if (ret) {
+		free(file);
+		return ret;
+	}
+	fd = install_file(file);
+	if (fd < 0)
+		fput(file);
+	return fd;
+}
+
+int
+kshim_close(int fd)
+{
+	struct file *file;
+
+	pthread_mutex_lock(&lock);
+	file = fd >= 0 && fd < MAX_FILES ? files[fd] : NULL;
+	if (file)
+		files[fd] = NULL;
+	pthread_mutex_unlock(&lock);
+	if (!file)
+		return -EBADF;
+	fput(file);
+	return 0;
+}
+
+ssize_t
+kshim_write(int fd, const void *buf, size_t len)
+{
+	struct file *file = lookup_file(fd);
+	loff_t pos = 0;
+	ssize_t ret;
+
+	if (!file)
+		return -EBADF;
+	ret = file->f_op->write ? file->f_op->write(file, buf, len, &pos)
+		: -EINVAL;
+	fput(file);
+	return ret;
+}
+
+long
+kshim_ioctl(int fd, unsigned cmd, void *arg)
+{
+	struct file *file = lookup_file(fd);
+	long ret;
+
+	if (!file)
+		return -EBADF;
+	ret = file->f_op->unlocked_ioctl
+		? file->f_op->unlocked_ioctl(file, cmd, (unsigned long) arg)
+		: -ENOTTY;
+	fput(file);
+	return ret;
+}
+
+int
+kshim_fsync(int fd)
+{
+	struct file *file = lookup_file(fd);
+	int ret;
+
+	if (!file)
+		return -EBADF;
+	ret = file->f_op->fsync ? file->f_op->fsync(file, 0, LLONG_MAX, 0)
+		: -EINVAL;
+	fput(file);
+	return ret;
+}
+
+static ssize_t
+kshim_rw(int fd, void *buf, size_t len, loff_t pos, bool write)
+{
+	struct file *file = lookup_file(fd);
+	struct kiocb iocb = { file, pos };
+	struct iov_iter iter = { buf, len, len };
+	ssize_t ret;
+
+	if (!file)
+		return -EBADF;
+	if (!(file->f_mode & (write ? FMODE_PWRITE : FMODE_PREAD)))
+		ret = -ESPIPE;
+	else if (write)
+		ret = file->f_op->write_iter
+			? file->f_op->write_iter(&iocb, &iter) : -EINVAL;
+	else
+		ret = file->f_op->read_iter
+			? file->f_op->read_iter(&iocb, &iter) : -EINVAL;
+	fput(file);
+	return ret;
+}
+
+ssize_t
+kshim_pread(int fd, void *buf, size_t len, loff_t pos)
+{
+	return kshim_rw(fd, buf, len, pos, false);
+}
+
+ssize_t
+kshim_pwrite(int fd, const void *buf, size_t len, loff_t pos)
+{
+	return kshim_rw(fd, (void *) buf, len, pos, true);
+}
+
+ssize_t
+generic_file_splice_read(struct file *in, loff_t *ppos,
+		struct pipe_inode_info *pipe, size_t len, unsigned int flags)
+{
+	struct kiocb iocb = { in, *ppos };
+	struct iov_iter to = { pipe->buf + pipe->len, len,
+		pipe->size - pipe->len };
+	ssize_t ret;
+
+	if (pipe->len == pipe->size)
+		return -EAGAIN;
+	ret = in->f_op->read_iter(&iocb, &to);
+	if (ret > 0) {
+		*ppos = iocb.ki_pos;
+		pipe->len += ret;
+	}
+	return ret;
+}
+
+ssize_t
+kshim_splice(int fd, loff_t *pos, void *pipe_buf, size_t room, size_t len)
+{
+	struct file *file = lookup_file(fd);
+	struct pipe_inode_info pipe = { pipe_buf, room, 0 };
+	ssize_t ret;
+
+	if (!file)
+		return -EBADF;
+	ret = file->f_op->splice_read
+		? file->f_op->splice_read(file, pos, &pipe, len, 0) : -EINVAL;
+	fput(file);
+	return ret;
+}
+
+static int
+fault(struct vm_area_struct *vma, unsigned long pgoff, unsigned flags,
+		void **addr)
+{
+	struct vm_fault vmf = { flags, pgoff };
+	int ret;
+
+	vma->pfn = 0;
+	ret = vma->vm_ops->fault(vma, &vmf);
+	if (ret & (VM_FAULT_OOM | VM_FAULT_SIGBUS))
+		return -1;
+	*addr = kshim_dma_to_virt((vmf.page ? kshim_page_to_pfn(vmf.page)
+				: vma->pfn) * PAGE_SIZE);
+	return 0;
+}
+
+static void *
+fault_file(int fd, unsigned long pgoff, bool write)
+{
+	struct file *file = lookup_file(fd);
+	struct vm_area_struct vma = { VM_SHARED | (write ? VM_WRITE : 0) };
+	struct vm_fault vmf = { FAULT_FLAG_WRITE, pgoff };
+	void *addr = NULL;
+
+	if (!file)
+		return NULL;
+	vma.vm_file = file;
+	if (!file->f_op->mmap || file->f_op->mmap(file, &vma)
+			|| fault(&vma, pgoff, write ? FAULT_FLAG_WRITE : 0,
+				&addr))
+		addr = NULL;
+	else if (write && vma.vm_ops->pfn_mkwrite && ((vma.vm_ops->pfn_mkwrite(
+					&vma, &vmf) & (VM_FAULT_OOM
+						| VM_FAULT_SIGBUS))
+				|| fault(&vma, pgoff, FAULT_FLAG_WRITE, &addr)))
+		addr = NULL;
+	fput(file);
+	return addr;
+}
+
+void *
+kshim_fault(int fd, unsigned long pgoff)
+{
+	return fault_file(fd, pgoff, false);
+}
+
+void *
+kshim_fault_write(int fd, unsigned long pgoff)
+{
+	return fault_file(fd, pgoff, true);
+}
@@ -0,0 +1,808 @@
+#ifndef KSHIM_H
+#define KSHIM_H
+
+/* Just enough of the kernel API to build the driver as a userspace program
+ * running against the device model. Every header under include/linux
+ * resolves to this one. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+/* types *********************************************************************/
+typedef uint32_t dma_addr_t;
+typedef unsigned long pgoff_t;
+typedef int irqreturn_t;
+typedef unsigned gfp_t;
+typedef unsigned long long u64;
+typedef int32_t s32;
+
+#define __iomem
+#define __init
+#define __rcu
+#define __user
+
+/* misc **********************************************************************/
+#define KERN_ERR		""
+#define KERN_INFO		""
+#define KERN_WARNING		""
+#define printk(...)		fprintf(stderr, __VA_ARGS__)
+#define dev_err(dev, ...)	fprintf(stderr, __VA_ARGS__)
+
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define min_t(type, a, b)	min((type) (a), (type) (b))
+#define READ_ONCE(x)		(*(volatile __typeof__(x) *) &(x))
+#define WRITE_ONCE(x, v)	(*(volatile __typeof__(x) *) &(x) = (v))
+#define container_of(ptr, type, member) \
+	((type *) ((char *) (ptr) - offsetof(type, member)))
+#define swap(a, b) \
+	do { __typeof__(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define roundup(x, y)		((((x) + (y) - 1) / (y)) * (y))
+#define rounddown(x, y)		((x) - ((x) % (y)))
+#define GENMASK(h, l) \
+	(((~0UL) << (l)) & (~0UL >> (8 * sizeof(unsigned long) - 1 - (h))))
+#define DMA_BIT_MASK(n)		(((n) == 64) ? ~0ULL : ((1ULL << (n)) - 1))
+
+#define BITS_PER_LONG		(8 * sizeof(unsigned long))
+#define BITS_TO_LONGS(n)	DIV_ROUND_UP(n, BITS_PER_LONG)
+
+static inline int
+test_bit(long nr, const unsigned long *addr)
+{
+	return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline void
+clear_bit(long nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline void
+bitmap_fill(unsigned long *dst, unsigned nbits)
+{
+	memset(dst, 0xff, BITS_TO_LONGS(nbits) * sizeof(unsigned long));
+}
+
+static inline unsigned long
+gcd(unsigned long a, unsigned long b)
+{
+	while (b) {
+		unsigned long t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static inline int
+fls64(u64 x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+#define div_u64(n, d)		((u64) (n) / (d))
+
+#define MAX_ERRNO		4095
+#define IS_ERR_VALUE(x)		((unsigned long) (x) >= (unsigned long) -MAX_ERRNO)
+#define IS_ERR(p)		IS_ERR_VALUE(p)
+#define PTR_ERR(p)		((long) (p))
+#define ERR_PTR(err)		((void *) (long) (err))
+
+typedef struct {
+	int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i)		{ (i) }
+#define atomic_inc_return(v) \
+	__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+
+/* time **********************************************************************/
+#define NSEC_PER_USEC		1000ULL
+#define NSEC_PER_MSEC		1000000ULL
+#define MAX_SCHEDULE_TIMEOUT	LONG_MAX
+#define cpu_relax()		__asm__ __volatile__("" ::: "memory")
+
+/* A jiffy is a millisecond. */
+#define msecs_to_jiffies(ms)	((long) (ms))
+
+u64
+ktime_get_ns(void);
+
+u64
+ktime_get_real_ns(void);
+
+/* tracepoints compile to nothing ********************************************/
+#define TP_PROTO(args...)	args
+#define TP_ARGS(args...)	args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) { }
+
+/* memory ********************************************************************/
+#define GFP_KERNEL		0
+#define PAGE_SHIFT		12
+#define PAGE_SIZE		(1UL << PAGE_SHIFT)
+
+#define kmalloc(size, gfp)	malloc(size)
+#define kcalloc(n, size, gfp)	calloc(n, size)
+#define kzalloc(size, gfp)	calloc(1, size)
+#define kzalloc_node(size, gfp, node)	calloc(1, size)
+#define kfree(p)		free(p)
+#define vzalloc(size)		calloc(1, size)
+#define vfree(p)		free(p)
+
+static inline unsigned long
+copy_from_user(void *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long
+copy_to_user(void *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+struct address_space {
+	int unused;
+};
+
+struct page {
+	int nid;
+};
+
+struct device {
+	char name[32];
+};
+
+/* Coherent DMA memory comes from one arena, so that bus addresses, virtual
+ * addresses and page structures translate into each other arithmetically. */
+void *
+dma_alloc_coherent(struct device *dev, size_t size, dma_addr_t *handle,
+		gfp_t gfp);
+
+void
+dma_free_coherent(struct device *dev, size_t size, void *addr,
+		dma_addr_t handle);
+
+/* Two nodes are simulated; coherent memory is on node 0, the device's. */
+#define NUMA_NO_NODE		(-1)
+#define nr_node_ids		2
+#define node_online(node)	((node) >= 0 && (node) < nr_node_ids)
+#define dev_to_node(dev)	0
+#define numa_node_id()		0
+#define page_to_nid(page)	((page)->nid)
+#define IS_ENABLED(option)	1
+
+#define GFP_DMA32		0x1
+#define __GFP_ZERO		0x2
+#define DMA_BIDIRECTIONAL	0
+
+struct page *
+alloc_pages_node(int node, gfp_t gfp, unsigned order);
+
+void
+__free_page(struct page *page);
+
+void *
+page_address(struct page *page);
+
+dma_addr_t
+dma_map_page(struct device *dev, struct page *page, size_t offset,
+		size_t size, int dir);
+
+#define dma_unmap_page(dev, handle, size, dir)	do { } while (0)
+#define dma_mapping_error(dev, handle)		0
+
+void *
+kshim_dma_to_virt(dma_addr_t handle);
+
+unsigned long
+kshim_pa(void *addr);
+
+struct page *
+kshim_pfn_to_page(unsigned long pfn);
+
+unsigned long
+kshim_page_to_pfn(struct page *page);
+
+#define __pa(addr)		kshim_pa((void *) (addr))
+#define pfn_to_page(pfn)	kshim_pfn_to_page(pfn)
+#define page_to_pfn(page)	kshim_page_to_pfn(page)
+#define get_page(page)		do { } while (0)
+#define unmap_mapping_range(mapping, start, len, even_cows) \
+	do { } while (0)
+
+/* mm ************************************************************************/
+#define VM_WRITE		0x2UL
+#define VM_SHARED		0x8UL
+#define VM_MAYWRITE		0x20UL
+#define VM_MIXEDMAP		0x10000000UL
+
+#define FAULT_FLAG_WRITE	0x01
+
+#define VM_FAULT_OOM		0x0001
+#define VM_FAULT_SIGBUS		0x0002
+#define VM_FAULT_NOPAGE		0x0100
+#define VM_FAULT_LOCKED		0x0200
+
+struct file;
+
+/* There are no page tables: a vma remembers the pfn inserted last. */
+struct vm_area_struct {
+	unsigned long vm_flags;
+	void *vm_private_data;
+	const struct vm_operations_struct *vm_ops;
+	struct file *vm_file;
+	unsigned long pfn;
+};
+
+struct vm_fault {
+	unsigned flags;
+	pgoff_t pgoff;
+	void __user *virtual_address;
+	struct page *page;
+};
+
+struct vm_operations_struct {
+	int (*fault)(struct vm_area_struct *, struct vm_fault *);
+	int (*pfn_mkwrite)(struct vm_area_struct *, struct vm_fault *);
+};
+
+typedef struct {
+	u64 val;
+} pfn_t;
+
+#define PFN_DEV			(1ULL << 61)
+#define __pfn_to_pfn_t(pfn, flags) \
+	((pfn_t) { .val = (u64) (pfn) | (flags) })
+#define pfn_t_to_pfn(pfn)	((unsigned long) ((pfn).val & ~PFN_DEV))
+
+static inline int
+vm_insert_mixed(struct vm_area_struct *vma, unsigned long addr, pfn_t pfn)
+{
+	vma->pfn = pfn_t_to_pfn(pfn);
+	return 0;
+}
+
+/* locking and waiting *******************************************************/
+struct mutex {
+	pthread_mutex_t m;
+};
+
+#define SINGLE_DEPTH_NESTING	1
+#define mutex_init(l)		pthread_mutex_init(&(l)->m, NULL)
+#define mutex_lock(l)		pthread_mutex_lock(&(l)->m)
+#define mutex_lock_nested(l, c)	pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l)		pthread_mutex_unlock(&(l)->m)
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} wait_queue_head_t;
+
+static inline void
+init_waitqueue_head(wait_queue_head_t *q)
+{
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+}
+
+static inline void
+wake_up(wait_queue_head_t *q)
+{
+	pthread_mutex_lock(&q->lock);
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+#define wake_up_all(q)		wake_up(q)
+
+#define wait_event(q, condition) \
+	do { \
+		pthread_mutex_lock(&(q).lock); \
+		while (!(condition)) \
+			pthread_cond_wait(&(q).cond, &(q).lock); \
+		pthread_mutex_unlock(&(q).lock); \
+	} while (0)
+
+/* Evaluates to the jiffies left, at least 1, if the condition holds, and to
+ * 0 on a timeout. */
+#define wait_event_timeout(q, condition, timeout) \
+	({ \
+		long __left = (timeout); \
+		u64 __end = ktime_get_real_ns() + __left * 1000000ULL; \
+		struct timespec __ts = { __end / 1000000000ULL, \
+			__end % 1000000000ULL }; \
+		bool __done; \
+		pthread_mutex_lock(&(q).lock); \
+		while (!(__done = (condition)) && (__left == \
+					MAX_SCHEDULE_TIMEOUT \
+				? pthread_cond_wait(&(q).cond, &(q).lock) \
+				: pthread_cond_timedwait(&(q).cond, \
+					&(q).lock, &__ts)) != ETIMEDOUT) \
+			; \
+		pthread_mutex_unlock(&(q).lock); \
+		if (!__done) \
+			__done = (condition); \
+		__done ? max(1L, (long) ((__end - ktime_get_real_ns()) \
+					/ 1000000)) : 0L; \
+	})
+
+struct kref {
+	int refcount;
+};
+
+static inline void
+kref_init(struct kref *kref)
+{
+	kref->refcount = 1;
+}
+
+static inline bool
+kref_get_unless_zero(struct kref *kref)
+{
+	int old = __atomic_load_n(&kref->refcount, __ATOMIC_SEQ_CST);
+
+	do {
+		if (old == 0)
+			return false;
+	} while (!__atomic_compare_exchange_n(&kref->refcount, &old, old + 1,
+				false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+	return true;
+}
+
+static inline int
+kref_put(struct kref *kref, void (*release)(struct kref *))
+{
+	if (__atomic_sub_fetch(&kref->refcount, 1, __ATOMIC_SEQ_CST))
+		return 0;
+	release(kref);
+	return 1;
+}
+
+/* Readers hold a shared lock, so a grace period is taking it exclusively.
+ * Freeing must not happen inside a read-side section. */
+extern pthread_rwlock_t kshim_rcu;
+
+struct rcu_head {
+	int unused;
+};
+
+#define rcu_read_lock()		pthread_rwlock_rdlock(&kshim_rcu)
+#define rcu_read_unlock()	pthread_rwlock_unlock(&kshim_rcu)
+#define rcu_dereference(p)	__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v) \
+	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define RCU_INIT_POINTER(p, v)	WRITE_ONCE(p, v)
+
+static inline void
+synchronize_rcu(void)
+{
+	pthread_rwlock_wrlock(&kshim_rcu);
+	pthread_rwlock_unlock(&kshim_rcu);
+}
+
+#define kfree_rcu(p, head) \
+	do { synchronize_rcu(); kfree(p); } while (0)
+
+/* An IDA handing out ids below KSHIM_IDA_SIZE. */
+#define KSHIM_IDA_SIZE		1024
+
+struct ida {
+	pthread_mutex_t lock;
+	unsigned long used[BITS_TO_LONGS(KSHIM_IDA_SIZE)];
+};
+
+void
+ida_init(struct ida *ida);
+
+/* Ids from start up to, but not including, end; 0 is no end. */
+int
+ida_simple_get(struct ida *ida, unsigned start, unsigned end, gfp_t gfp);
+
+void
+ida_simple_remove(struct ida *ida, unsigned id);
+
+#define ida_destroy(ida)	do { } while (0)
+
+/* files *********************************************************************/
+struct module;
+#define THIS_MODULE		((struct module *) NULL)
+
+#define MINORBITS		20
+#define MINORMASK		((1U << MINORBITS) - 1)
+#define MAJOR(dev)		((unsigned) ((dev) >> MINORBITS))
+#define MINOR(dev)		((unsigned) ((dev) & MINORMASK))
+#define MKDEV(ma, mi)		(((ma) << MINORBITS) | (mi))
+
+
+struct inode {
+	dev_t i_rdev;
+	struct address_space i_data;
+	void *i_private;
+};
+
+#define FMODE_LSEEK		0x4
+#define FMODE_PREAD		0x8
+#define FMODE_PWRITE		0x10
+
+struct file {
+	const struct file_operations *f_op;
+	void *private_data;
+	struct address_space *f_mapping;
+	unsigned f_flags;
+	unsigned f_mode;
+	int f_count;
+	struct inode *f_inode;
+};
+
+struct kiocb {
+	struct file *ki_filp;
+	loff_t ki_pos;
+};
+
+/* A single user buffer, or the free space of a pipe. A pipe may have less
+ * room than the count asked for, as an ITER_PIPE iterator does. */
+struct iov_iter {
+	uint8_t *buf;
+	size_t count;
+	size_t room;
+};
+
+static inline size_t
+iov_iter_count(const struct iov_iter *i)
+{
+	return i->count;
+}
+
+static inline size_t
+copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i)
+{
+	bytes = min(bytes, min(i->count, i->room));
+	memcpy(i->buf, addr, bytes);
+	i->buf += bytes;
+	i->count -= bytes;
+	i->room -= bytes;
+	return bytes;
+}
+
+static inline size_t
+copy_from_iter(void *addr, size_t bytes, struct iov_iter *i)
+{
+	bytes = min(bytes, min(i->count, i->room));
+	memcpy(addr, i->buf, bytes);
+	i->buf += bytes;
+	i->count -= bytes;
+	i->room -= bytes;
+	return bytes;
+}
+
+/* A pipe is a flat buffer of size bytes, len of them filled. */
+struct pipe_inode_info {
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+};
+
+/* As on 4.9: reads through ->read_iter into the free space of the pipe. */
+ssize_t
+generic_file_splice_read(struct file *in, loff_t *ppos,
+		struct pipe_inode_info *pipe, size_t len, unsigned int flags);
+
+/* Splicing into a file is not modelled. */
+#define iter_file_splice_write		NULL
+
+loff_t
+fixed_size_llseek(struct file *file, loff_t offset, int whence, loff_t size);
+
+struct file_operations {
+	struct module *owner;
+	int (*open)(struct inode *, struct file *);
+	int (*release)(struct inode *, struct file *);
+	ssize_t (*read)(struct file *, char *, size_t, loff_t *);
+	loff_t (*llseek)(struct file *, loff_t, int);
+	long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+	int (*mmap)(struct file *, struct vm_area_struct *);
+	ssize_t (*write)(struct file *, const char *, size_t, loff_t *);
+	ssize_t (*read_iter)(struct kiocb *, struct iov_iter *);
+	ssize_t (*write_iter)(struct kiocb *, struct iov_iter *);
+	ssize_t (*splice_read)(struct file *, loff_t *,
+			struct pipe_inode_info *, size_t, unsigned int);
+	void *splice_write;
+	int (*fsync)(struct file *, loff_t, loff_t, int);
+};
+
+struct fd {
+	struct file *file;
+};
+
+static inline unsigned
+iminor(const struct inode *inode)
+{
+	return MINOR(inode->i_rdev);
+}
+
+struct fd
+fdget(int fd);
+
+void
+fdput(struct fd f);
+
+struct file *
+get_file(struct file *f);
+
+void
+fput(struct file *f);
+
+int
+anon_inode_getfd(const char *name, const struct file_operations *fops,
+		void *priv, int flags);
+
+struct file *
+anon_inode_getfile(const char *name, const struct file_operations *fops,
+		void *priv, int flags);
+
+int
+get_unused_fd_flags(unsigned flags);
+
+void
+put_unused_fd(int fd);
+
+void
+fd_install(int fd, struct file *file);
+
+struct cdev {
+	const struct file_operations *ops;
+	struct module *owner;
+	dev_t dev;
+};
+
+struct cdev *
+cdev_alloc(void);
+
+void
+cdev_init(struct cdev *cdev, const struct file_operations *fops);
+
+int
+cdev_add(struct cdev *cdev, dev_t dev, unsigned count);
+
+void
+cdev_del(struct cdev *cdev);
+
+int
+alloc_chrdev_region(dev_t *dev, unsigned first, unsigned count,
+		const char *name);
+
+void
+unregister_chrdev_region(dev_t dev, unsigned count);
+
+/* debugfs ******************************************************************/
+struct dentry {
+	char name[32];
+	struct dentry *parent;
+	void *data;
+	const struct file_operations *fops;
+	bool removed;
+};
+
+struct seq_file;
+
+struct seq_operations {
+	void *(*start)(struct seq_file *, loff_t *);
+	void *(*next)(struct seq_file *, void *, loff_t *);
+	void (*stop)(struct seq_file *, void *);
+	int (*show)(struct seq_file *, void *);
+};
+
+/* Files opened with single_open have no op, only show. */
+struct seq_file {
+	void *private;
+	int (*show)(struct seq_file *, void *);
+	const struct seq_operations *op;
+	FILE *out;
+};
+
+#define SEQ_START_TOKEN		((void *) 1)
+
+struct dentry *
+debugfs_create_dir(const char *name, struct dentry *parent);
+
+struct dentry *
+debugfs_create_file(const char *name, unsigned mode, struct dentry *parent,
+		void *data, const struct file_operations *fops);
+
+void
+debugfs_remove(struct dentry *dentry);
+
+void
+debugfs_remove_recursive(struct dentry *dentry);
+
+int
+single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data);
+
+int
+single_release(struct inode *inode, struct file *file);
+
+int
+seq_open(struct file *file, const struct seq_operations *op);
+
+#define seq_release		single_release
+
+#define seq_read		NULL
+#define seq_lseek		NULL
+#define seq_printf(s, ...)	fprintf((s)->out, __VA_ARGS__)
+
+struct class {
+	int unused;
+};
+
+struct class *
+class_create(struct module *owner, const char *name);
+
+void
+class_destroy(struct class *class);
+
+struct device *
+device_create(struct class *class, struct device *parent, dev_t devt,
+		void *data, const char *fmt, ...);
+
+void
+device_destroy(struct class *class, dev_t devt);
+
+#define dev_name(dev)		((const char *) (dev)->name)
+
+/* module ********************************************************************/
+#define MODULE_LICENSE(license)
+#define MODULE_DEVICE_TABLE(type, name)
+#define module_param(name, type, perm)
+#define module_init(fn)		int kshim_module_init(void) { return fn(); }
+#define module_exit(fn)		void kshim_module_exit(void) { fn(); }
+
+int
+kshim_module_init(void);
+
+void
+kshim_module_exit(void);
+
+/* pci and interrupts ********************************************************/
+#define IRQF_SHARED		0x80
+#define IRQ_NONE		0
+#define IRQ_HANDLED		1
+
+typedef irqreturn_t (*irq_handler_t)(int, void *);
+
+struct pci_dev {
+	struct device dev;
+	unsigned irq;
+	void *driver_data;
+};
+
+#define pci_set_drvdata(pdev, data)	((pdev)->driver_data = (data))
+#define pci_get_drvdata(pdev)		((pdev)->driver_data)
+#define pci_dev_get(pdev)		(pdev)
+#define pci_dev_put(pdev)		do { } while (0)
+
+struct pci_device_id {
+	unsigned vendor, device;
+};
+
+#define PCI_DEVICE(vend, dev)	.vendor = (vend), .device = (dev)
+
+struct pci_driver {
+	const char *name;
+	const struct pci_device_id *id_table;
+	int (*probe)(struct pci_dev *, const struct pci_device_id *);
+	void (*remove)(struct pci_dev *);
+};
+
+int
+pci_register_driver(struct pci_driver *drv);
+
+void
+pci_unregister_driver(struct pci_driver *drv);
+
+#define pci_enable_device(dev)			0
+#define pci_disable_device(dev)			do { } while (0)
+#define pci_request_regions(dev, name)		0
+#define pci_release_regions(dev)		do { } while (0)
+#define pci_set_master(dev)			do { } while (0)
+
+static inline int
+pci_set_dma_mask(struct pci_dev *dev, uint64_t mask)
+{
+	return 0;
+}
+
+static inline int
+pci_set_consistent_dma_mask(struct pci_dev *dev, uint64_t mask)
+{
+	return 0;
+}
+
+#define pci_iounmap(dev, addr)			do { } while (0)
+
+void __iomem *
+pci_iomap(struct pci_dev *dev, int bar, unsigned long max);
+
+int
+request_irq(unsigned irq, irq_handler_t handler, unsigned long flags,
+		const char *name, void *dev_id);
+
+void
+free_irq(unsigned irq, void *dev_id);
+
+/* Handlers running on the thread of the model are not waited for. */
+#define synchronize_irq(irq)		do { } while (0)
+
+unsigned
+ioread32(void __iomem *addr);
+
+void
+iowrite32(unsigned value, void __iomem *addr);
+
+/* harness *******************************************************************/
+struct v2d_model;
+
+/* Registers a model as a PCI device and probes the driver with it. */
+int
+kshim_add_device(struct v2d_model *model);
+
+void
+kshim_remove_devices(void);
+
+/* The file operations the harness calls in place of system calls. */
+int
+kshim_open(unsigned minor);
+
+int
+kshim_close(int fd);
+
+ssize_t
+kshim_write(int fd, const void *buf, size_t len);
+
+long
+kshim_ioctl(int fd, unsigned cmd, void *arg);
+
+int
+kshim_fsync(int fd);
+
+ssize_t
+kshim_pread(int fd, void *buf, size_t len, loff_t pos);
+
+ssize_t
+kshim_pwrite(int fd, const void *buf, size_t len, loff_t pos);
+
+/* Splices up to len bytes of the file at *pos into a pipe with room bytes of
+ * free space at pipe_buf, as splice(2) into an empty pipe would. */
+ssize_t
+kshim_splice(int fd, loff_t *pos, void *pipe_buf, size_t room, size_t len);
+
+/* Returns the address of a page of the mapping of the file, as faulted in by
+ * the driver, or NULL. */
+void *
+kshim_fault(int fd, unsigned long pgoff);
+
+/* As above, for a write: the page is made writable with pfn_mkwrite and
+ * faulted in again, as the kernel retries an access after it. */
+void *
+kshim_fault_write(int fd, unsigned long pgoff);
+
+/* Prints a debugfs file of the driver, named by its path under debugfs. */
+int
+kshim_debugfs_print(const char *path, FILE *out);
+
+#endif
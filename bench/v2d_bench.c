@@ -0,0 +1,259 @@
+#include <getopt.h>
+#include <time.h>
+
+#include "kshim.h"
+#include "v2d_model.h"
+#include "../v2d_ioctl.h"
+
+/* Runs the driver against the device model and reports its throughput for
+ * fill-heavy, blit-heavy and multi-context workloads. Every call to a file
+ * operation of the driver counts as one system call. With -b the commands of
+ * a frame are submitted with a single write. */
+
+typedef struct {
+	const char *name;
+	int threads;
+	bool blit;
+} workload_t;
+
+typedef struct {
+	const workload_t *workload;
+	unsigned seed;
+	double *latencies;
+	int syncs;
+	int failed;
+	bool capture;
+} worker_t;
+
+static int draws = 20000;
+static int threads = 4;
+static int canvas_size = 512;
+static int rect_size = 32;
+static int frame = 64;
+static bool verbose;
+static bool batch;
+static const char *capture_path;
+
+static v2d_model_t model;
+static long syscalls;
+static bool captured;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+submit(int fd, const unsigned *cmds, int count)
+{
+	__atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+	return kshim_write(fd, cmds, count * 4) == count * 4 ? 0 : -1;
+}
+
+static unsigned
+pos(unsigned *seed)
+{
+	return rand_r(seed) % (canvas_size - rect_size + 1);
+}
+
+/* Appends the commands of a draw to cmds; unless batching, submits them one
+ * at a time. */
+static int
+draw(int fd, const workload_t *workload, unsigned *seed, unsigned *cmds,
+		int *count)
+{
+	unsigned *c = cmds + *count;
+	int i;
+
+	if (workload->blit) {
+		c[0] = V2D_CMD_SRC_POS(pos(seed), pos(seed));
+		c[1] = V2D_CMD_DST_POS(pos(seed), pos(seed));
+		c[2] = V2D_CMD_DO_BLIT(rect_size, rect_size);
+	} else {
+		c[0] = V2D_CMD_FILL_COLOR(rand_r(seed) & 0xff);
+		c[1] = V2D_CMD_DST_POS(pos(seed), pos(seed));
+		c[2] = V2D_CMD_DO_FILL(rect_size, rect_size);
+	}
+	if (batch) {
+		*count += 3;
+		return 0;
+	}
+	for (i = 0; i < 3; ++i)
+		if (submit(fd, c + i, 1))
+			return -1;
+	return 0;
+}
+
+static void *
+work(void *arg)
+{
+	worker_t *worker = arg;
+	struct v2d_ioctl_set_dimensions dim = { canvas_size, canvas_size };
+	/* A draw is three commands and up to three writes, plus a share of
+	 * the fsyncs. */
+	struct v2d_ioctl_capture cap = { min(7 * draws + 8,
+			V2D_CAPTURE_MAX_ENTRIES) };
+	unsigned *cmds = malloc(3 * frame * sizeof(unsigned));
+	double start;
+	FILE *f;
+	int fd, i, count = 0;
+
+	fd = kshim_open(0);
+	__atomic_fetch_add(&syscalls, 2, __ATOMIC_RELAXED);
+	if (!cmds || fd < 0 || (worker->capture
+				&& kshim_ioctl(fd, V2D_IOCTL_CAPTURE, &cap))
+			|| kshim_ioctl(fd, V2D_IOCTL_SET_DIMENSIONS, &dim)) {
+		worker->failed = 1;
+		free(cmds);
+		return NULL;
+	}
+	for (i = 0; i < draws; ++i) {
+		if (draw(fd, worker->workload, &worker->seed, cmds, &count)) {
+			worker->failed = 1;
+			break;
+		}
+		if ((i + 1) % frame == 0 || i + 1 == draws) {
+			if (count && submit(fd, cmds, count))
+				worker->failed = 1;
+			count = 0;
+			__atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+			start = now();
+			if (kshim_fsync(fd))
+				worker->failed = 1;
+			worker->latencies[worker->syncs++] = now() - start;
+		}
+	}
+	/* The first context opened by the process is ctx1. */
+	if (worker->capture) {
+		f = fopen(capture_path, "w");
+		if (!f || kshim_debugfs_print("v2d/v2d0/ctx1_capture", f))
+			worker->failed = 1;
+		if (f)
+			fclose(f);
+	}
+	__atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+	kshim_close(fd);
+	free(cmds);
+	return NULL;
+}
+
+static int
+compare(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double
+percentile(double *sorted, int count, int p)
+{
+	return count ? sorted[(count - 1) * p / 100] * 1e6 : 0;
+}
+
+static int
+run(const workload_t *workload)
+{
+	pthread_t tids[workload->threads];
+	worker_t workers[workload->threads];
+	int i, j, syncs = 0, failed = 0,
+	    total = draws * workload->threads,
+	    per_worker = draws / frame + 1;
+	double start, elapsed,
+	       *latencies = calloc(per_worker * workload->threads,
+			       sizeof(double));
+
+	syscalls = 0;
+	v2d_model_reset_stats(&model);
+	start = now();
+	for (i = 0; i < workload->threads; ++i) {
+		workers[i].workload = workload;
+		workers[i].seed = i + 1;
+		workers[i].latencies = latencies + i * per_worker;
+		workers[i].syncs = 0;
+		workers[i].failed = 0;
+		workers[i].capture = capture_path && i == 0 && !captured;
+		pthread_create(&tids[i], NULL, work, &workers[i]);
+	}
+	for (i = 0; i < workload->threads; ++i) {
+		pthread_join(tids[i], NULL);
+		failed |= workers[i].failed;
+		for (j = 0; j < workers[i].syncs; ++j)
+			latencies[syncs++] = workers[i].latencies[j];
+	}
+	elapsed = now() - start;
+	qsort(latencies, syncs, sizeof(double), compare);
+
+	printf("%-8s %8.0f draws/s %9.0f cmds/s %5.2f syscalls/draw "
+			"%6.1f avg %4u max ring %5.2f irqs/draw "
+			"%6.2f tlb misses/draw  sync us p50 %.0f p90 %.0f "
+			"p99 %.0f%s\n",
+			workload->name, total / elapsed,
+			model.cmds / elapsed, (double) syscalls / total,
+			model.occupancy_samples ? (double) model.occupancy_sum
+				/ model.occupancy_samples : 0,
+			model.occupancy_max, (double) model.irqs / total,
+			(double) model.tlb_misses / total,
+			percentile(latencies, syncs, 50),
+			percentile(latencies, syncs, 90),
+			percentile(latencies, syncs, 99),
+			failed ? "  FAILED" : "");
+	captured = true;
+	free(latencies);
+	return failed;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n draws] [-t threads] [-s canvas size] "
+			"[-r rectangle size] [-f draws per fsync] "
+			"[-p ns per pixel] [-b] [-v] [-c capture file]\n", name);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	workload_t workloads[] = {
+		{ "fill", 1, false },
+		{ "blit", 1, true },
+		{ "multi", 0, false },
+	};
+	unsigned pixel_ns = 0;
+	int opt, i, failed = 0;
+
+	while ((opt = getopt(argc, argv, "n:t:s:r:f:p:bvc:")) != -1)
+		switch (opt) {
+		case 'n': draws = atoi(optarg); break;
+		case 't': threads = atoi(optarg); break;
+		case 's': canvas_size = atoi(optarg); break;
+		case 'r': rect_size = atoi(optarg); break;
+		case 'f': frame = atoi(optarg); break;
+		case 'p': pixel_ns = atoi(optarg); break;
+		case 'b': batch = true; break;
+		case 'v': verbose = true; break;
+		case 'c': capture_path = optarg; break;
+		default: usage(argv[0]);
+		}
+	if (draws <= 0 || threads <= 0 || frame <= 0 || rect_size <= 0
+			|| canvas_size > 2048 || rect_size > canvas_size)
+		usage(argv[0]);
+	workloads[2].threads = threads;
+
+	if (kshim_module_init() || kshim_add_device(&model)) {
+		fprintf(stderr, "v2d_bench: cannot set up the device\n");
+		return 1;
+	}
+	model.pixel_ns = pixel_ns;
+	for (i = 0; i < 3; ++i)
+		failed |= run(&workloads[i]);
+	if (verbose)
+		kshim_debugfs_print("v2d/v2d0/stats", stdout);
+	kshim_module_exit();
+	return failed;
+}
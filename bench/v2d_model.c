@@ -0,0 +1,298 @@
+#include <string.h>
+#include <time.h>
+
+#include "kshim.h"
+#include "v2d_model.h"
+#include "../vintage2d.h"
+
+#define REG(model, offset) ((model)->regs[(offset) / 4])
+#define INTR_ERRORS (VINTAGE2D_INTR_INVALID_CMD | VINTAGE2D_INTR_PAGE_FAULT \
+		| VINTAGE2D_INTR_CANVAS_OVERFLOW | VINTAGE2D_INTR_FIFO_OVERFLOW)
+
+static bool
+fetching(v2d_model_t *model)
+{
+	unsigned enable = VINTAGE2D_ENABLE_DRAW | VINTAGE2D_ENABLE_FETCH_CMD;
+
+	return (REG(model, VINTAGE2D_ENABLE) & enable) == enable
+		&& REG(model, VINTAGE2D_CMD_READ_PTR)
+			!= REG(model, VINTAGE2D_CMD_WRITE_PTR);
+}
+
+static void
+sample_occupancy(v2d_model_t *model)
+{
+	unsigned r = REG(model, VINTAGE2D_CMD_READ_PTR),
+		 w = REG(model, VINTAGE2D_CMD_WRITE_PTR),
+		 occupancy;
+
+	/* The ring is one page, ending with a jump to its start. */
+	occupancy = r <= w ? (w - r) / 4
+		: (w + VINTAGE2D_PAGE_SIZE - 4 - r) / 4;
+	model->occupancy_sum += occupancy;
+	++model->occupancy_samples;
+	if (occupancy > model->occupancy_max)
+		model->occupancy_max = occupancy;
+}
+
+/* Returns the page of the canvas through the source or the destination TLB,
+ * or NULL on a page fault. */
+static uint8_t *
+translate(v2d_model_t *model, bool src, unsigned page)
+{
+	unsigned tag_reg = src ? VINTAGE2D_SRC_TLB_TAG : VINTAGE2D_DST_TLB_TAG,
+		 pte_reg = src ? VINTAGE2D_SRC_TLB_PTE : VINTAGE2D_DST_TLB_PTE,
+		 pt = REG(model, VINTAGE2D_DRAW_STATE_CANVAS_PT),
+		 tag = pt | page << 2 | 1,
+		 pte;
+
+	if (REG(model, tag_reg) != tag) {
+		if (model->miss_ns) {
+			struct timespec ts = { 0, model->miss_ns };
+			unsigned resets = model->resets;
+
+			pthread_mutex_unlock(&model->lock);
+			nanosleep(&ts, NULL);
+			pthread_mutex_lock(&model->lock);
+			if (model->resets != resets)
+				return NULL;
+		}
+		if (page >= VINTAGE2D_PAGE_SIZE / 4)
+			return NULL;
+		pte = ((unsigned *) kshim_dma_to_virt(pt))[page];
+		if (!(pte & VINTAGE2D_PTE_VALID))
+			return NULL;
+		REG(model, tag_reg) = tag;
+		REG(model, pte_reg) = pte;
+		++model->tlb_misses;
+	}
+	return kshim_dma_to_virt(REG(model, pte_reg) & ~0xfff);
+}
+
+/* Reads (src), writes or fills (color >= 0) a run of the row-linear canvas,
+ * page by page in the direction of drawing. */
+static bool
+access_run(v2d_model_t *model, bool src, unsigned start, unsigned len,
+		bool left, uint8_t *buf, int color)
+{
+	unsigned first = start / VINTAGE2D_PAGE_SIZE,
+		 last = (start + len - 1) / VINTAGE2D_PAGE_SIZE,
+		 i, page, lo, hi;
+	uint8_t *p;
+
+	for (i = 0; i <= last - first; ++i) {
+		page = left ? last - i : first + i;
+		lo = page * VINTAGE2D_PAGE_SIZE > start
+			? page * VINTAGE2D_PAGE_SIZE : start;
+		hi = (page + 1) * VINTAGE2D_PAGE_SIZE < start + len
+			? (page + 1) * VINTAGE2D_PAGE_SIZE : start + len;
+		p = translate(model, src, page);
+		if (!p)
+			return false;
+		p += lo % VINTAGE2D_PAGE_SIZE;
+		if (color >= 0)
+			memset(p, color, hi - lo);
+		else if (src)
+			memcpy(buf + lo - start, p, hi - lo);
+		else
+			memcpy(p, buf + lo - start, hi - lo);
+	}
+	return true;
+}
+
+static unsigned
+draw(v2d_model_t *model, unsigned cmd)
+{
+	bool blit = VINTAGE2D_CMD_TYPE(cmd) == VINTAGE2D_CMD_TYPE_DO_BLIT,
+	     reverse, up, left;
+	unsigned dims = REG(model, VINTAGE2D_DRAW_STATE_CANVAS_DIMS),
+		 src = REG(model, VINTAGE2D_DRAW_STATE_SRC_POS),
+		 dst = REG(model, VINTAGE2D_DRAW_STATE_DST_POS),
+		 canvas_width = VINTAGE2D_CMD_WIDTH(dims),
+		 canvas_height = VINTAGE2D_CMD_HEIGHT(dims),
+		 sx = VINTAGE2D_CMD_POS_X(src), sy = VINTAGE2D_CMD_POS_Y(src),
+		 dx = VINTAGE2D_CMD_POS_X(dst), dy = VINTAGE2D_CMD_POS_Y(dst),
+		 width = VINTAGE2D_CMD_WIDTH(cmd),
+		 height = VINTAGE2D_CMD_HEIGHT(cmd),
+		 i, row, resets = model->resets;
+	int color = blit ? -1 : (int) VINTAGE2D_CMD_COLOR(
+			REG(model, VINTAGE2D_DRAW_STATE_FILL_COLOR));
+
+	if (dx + width > canvas_width || dy + height > canvas_height
+			|| (blit && (sx + width > canvas_width
+					|| sy + height > canvas_height)))
+		return VINTAGE2D_INTR_CANVAS_OVERFLOW;
+	reverse = blit && sx < dx + width && dx < sx + width
+		&& sy < dy + height && dy < sy + height;
+	up = reverse && dy > sy;
+	left = reverse && dy == sy && dx > sx;
+
+	for (i = 0; i < height; ++i) {
+		row = up ? height - 1 - i : i;
+		if ((blit && !access_run(model, true,
+					(sy + row) * canvas_width + sx, width,
+					left, model->row, -1))
+				|| !access_run(model, false,
+					(dy + row) * canvas_width + dx,
+					width, left, model->row, color))
+			return model->resets != resets ? 0
+				: VINTAGE2D_INTR_PAGE_FAULT;
+	}
+	++model->draws;
+	model->pixels += width * height;
+	return 0;
+}
+
+static unsigned
+execute(v2d_model_t *model, unsigned cmd)
+{
+	switch (VINTAGE2D_CMD_TYPE(cmd)) {
+	case VINTAGE2D_CMD_TYPE_CANVAS_PT:
+		REG(model, VINTAGE2D_DRAW_STATE_CANVAS_PT) =
+			VINTAGE2D_CMD_PT(cmd);
+		return 0;
+	case VINTAGE2D_CMD_TYPE_CANVAS_DIMS:
+		REG(model, VINTAGE2D_DRAW_STATE_CANVAS_DIMS) = cmd;
+		return 0;
+	case VINTAGE2D_CMD_TYPE_SRC_POS:
+		REG(model, VINTAGE2D_DRAW_STATE_SRC_POS) = cmd;
+		return 0;
+	case VINTAGE2D_CMD_TYPE_DST_POS:
+		REG(model, VINTAGE2D_DRAW_STATE_DST_POS) = cmd;
+		return 0;
+	case VINTAGE2D_CMD_TYPE_FILL_COLOR:
+		REG(model, VINTAGE2D_DRAW_STATE_FILL_COLOR) = cmd;
+		return 0;
+	case VINTAGE2D_CMD_TYPE_DO_BLIT:
+	case VINTAGE2D_CMD_TYPE_DO_FILL:
+		return draw(model, cmd);
+	case VINTAGE2D_CMD_TYPE_COUNTER:
+		REG(model, VINTAGE2D_COUNTER) = VINTAGE2D_CMD_COUNTER_VALUE(cmd);
+		return 0;
+	default:
+		return VINTAGE2D_INTR_INVALID_CMD;
+	}
+}
+
+static void
+step(v2d_model_t *model)
+{
+	unsigned read = REG(model, VINTAGE2D_CMD_READ_PTR),
+		 cmd = *(unsigned *) kshim_dma_to_virt(read),
+		 intr, pixels = model->pixels;
+
+	sample_occupancy(model);
+	if (VINTAGE2D_CMD_KIND(cmd) == VINTAGE2D_CMD_KIND_JUMP) {
+		REG(model, VINTAGE2D_CMD_READ_PTR) = cmd & ~3;
+		return;
+	}
+	REG(model, VINTAGE2D_CMD_READ_PTR) = read + 4;
+	++model->cmds;
+	intr = execute(model, cmd);
+	if (!intr && VINTAGE2D_CMD_KIND(cmd) == VINTAGE2D_CMD_KIND_CMD_NOTIFY)
+		intr = VINTAGE2D_INTR_NOTIFY;
+	if (intr & INTR_ERRORS)
+		REG(model, VINTAGE2D_ENABLE) = 0;
+	REG(model, VINTAGE2D_INTR) |= intr;
+
+	if (model->pixel_ns && model->pixels != pixels) {
+		uint64_t ns = (model->pixels - pixels) * model->pixel_ns;
+		struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+
+		pthread_mutex_unlock(&model->lock);
+		nanosleep(&ts, NULL);
+		pthread_mutex_lock(&model->lock);
+	}
+	if (REG(model, VINTAGE2D_INTR) & REG(model, VINTAGE2D_INTR_ENABLE)
+			&& model->irq_handler) {
+		++model->irqs;
+		pthread_mutex_unlock(&model->lock);
+		model->irq_handler(model->irq, model->irq_dev);
+		pthread_mutex_lock(&model->lock);
+	}
+}
+
+static void *
+run(void *arg)
+{
+	v2d_model_t *model = arg;
+
+	pthread_mutex_lock(&model->lock);
+	while (!model->stop) {
+		if (fetching(model))
+			step(model);
+		else
+			pthread_cond_wait(&model->doorbell, &model->lock);
+	}
+	pthread_mutex_unlock(&model->lock);
+	return NULL;
+}
+
+int
+v2d_model_start(v2d_model_t *model, unsigned irq)
+{
+	memset(model, 0, sizeof(*model));
+	pthread_mutex_init(&model->lock, NULL);
+	pthread_cond_init(&model->doorbell, NULL);
+	model->irq = irq;
+	return pthread_create(&model->thread, NULL, run, model);
+}
+
+void
+v2d_model_stop(v2d_model_t *model)
+{
+	pthread_mutex_lock(&model->lock);
+	model->stop = true;
+	pthread_cond_signal(&model->doorbell);
+	pthread_mutex_unlock(&model->lock);
+	pthread_join(model->thread, NULL);
+}
+
+void
+v2d_model_reset_stats(v2d_model_t *model)
+{
+	pthread_mutex_lock(&model->lock);
+	model->cmds = model->draws = model->pixels = model->irqs = 0;
+	model->tlb_misses = model->occupancy_sum = 0;
+	model->occupancy_samples = 0;
+	model->occupancy_max = 0;
+	pthread_mutex_unlock(&model->lock);
+}
+
+unsigned
+v2d_model_read(v2d_model_t *model, unsigned offset)
+{
+	unsigned value;
+
+	pthread_mutex_lock(&model->lock);
+	if (offset == VINTAGE2D_STATUS)
+		value = fetching(model) ? VINTAGE2D_STATUS_FETCH_CMD
+			| VINTAGE2D_STATUS_DRAW : 0;
+	else
+		value = REG(model, offset);
+	pthread_mutex_unlock(&model->lock);
+	return value;
+}
+
+void
+v2d_model_write(v2d_model_t *model, unsigned offset, unsigned value)
+{
+	pthread_mutex_lock(&model->lock);
+	switch (offset) {
+	case VINTAGE2D_INTR:
+		REG(model, offset) &= ~value;
+		break;
+	case VINTAGE2D_RESET:
+		if (value & VINTAGE2D_RESET_DRAW)
+			++model->resets;
+		if (value & VINTAGE2D_RESET_TLB)
+			REG(model, VINTAGE2D_SRC_TLB_TAG) =
+				REG(model, VINTAGE2D_DST_TLB_TAG) = 0;
+		break;
+	default:
+		REG(model, offset) = value;
+		break;
+	}
+	pthread_cond_signal(&model->doorbell);
+	pthread_mutex_unlock(&model->lock);
+}
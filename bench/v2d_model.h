@@ -0,0 +1,64 @@
+#ifndef V2D_MODEL_H
+#define V2D_MODEL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define V2D_MODEL_REGS 0x100
+
+typedef int (*v2d_model_irq_t)(int, void *);
+
+/* A software vintage2d: the register map, the command block fetching from a
+ * ring with JUMP, COUNTER, interrupts, the page table walk with single-entry
+ * source and destination TLBs, FILL and BLIT. Commands are executed by a
+ * thread of the model, as the device would do it asynchronously. On an error
+ * the model raises its interrupt and stops until enabled again. */
+typedef struct v2d_model {
+	pthread_mutex_t lock;
+	pthread_cond_t doorbell;
+	pthread_t thread;
+	bool stop;
+
+	unsigned regs[V2D_MODEL_REGS / 4];
+	char mmio[V2D_MODEL_REGS];
+	uint8_t row[2048];
+
+	unsigned irq;
+	v2d_model_irq_t irq_handler;
+	void *irq_dev;
+
+	/* Nanoseconds the model spends per drawn pixel, 0 to draw at once. */
+	unsigned pixel_ns;
+	/* Nanoseconds of a TLB miss, spent unlocked in the middle of the draw,
+	 * so that the tags can be watched changing. */
+	unsigned miss_ns;
+	/* Bumped by RESET_DRAW, which aborts a draw stalled on a miss. */
+	unsigned resets;
+
+	uint64_t cmds;
+	uint64_t draws;
+	uint64_t pixels;
+	uint64_t irqs;
+	uint64_t tlb_misses;
+	uint64_t occupancy_sum;
+	uint64_t occupancy_samples;
+	unsigned occupancy_max;
+} v2d_model_t;
+
+int
+v2d_model_start(v2d_model_t *model, unsigned irq);
+
+void
+v2d_model_stop(v2d_model_t *model);
+
+void
+v2d_model_reset_stats(v2d_model_t *model);
+
+unsigned
+v2d_model_read(v2d_model_t *model, unsigned offset);
+
+void
+v2d_model_write(v2d_model_t *model, unsigned offset, unsigned value);
+
+#endif
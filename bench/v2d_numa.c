@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../v2d_ioctl.h"
+
+/* Measures a real device with the canvas allocated on the device's node
+ * (-1) and on every online node in turn: the bandwidth of CPU writes and
+ * reads through the mapping and the throughput of device fills and blits.
+ * The process runs on the CPUs of the node given with -c (by default its
+ * own), so the rows show the cost of local and remote canvases. */
+
+#define CANVAS_SIZE	2048
+#define RECT_SIZE	256
+#define MAX_NODES	64
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Parses a list such as "0-3,8" into set (CPUs) or nodes (node numbers). */
+static int
+parse_list(const char *path, cpu_set_t *set, int *nodes)
+{
+	FILE *f = fopen(path, "r");
+	char line[4096], *p;
+	int from, to, count = 0;
+
+	if (!f)
+		return -1;
+	if (!fgets(line, sizeof(line), f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	for (p = strtok(line, ",\n"); p; p = strtok(NULL, ",\n")) {
+		if (sscanf(p, "%d-%d", &from, &to) != 2)
+			to = from = atoi(p);
+		for (; from <= to; ++from) {
+			if (set)
+				CPU_SET(from, set);
+			else if (count < MAX_NODES)
+				nodes[count] = from;
+			++count;
+		}
+	}
+	return count < MAX_NODES || set ? count : MAX_NODES;
+}
+
+static int
+pin(int node)
+{
+	char path[64];
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+			node);
+	if (parse_list(path, &set, NULL) <= 0)
+		return -1;
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+static int
+submit(int fd, const uint32_t *cmds, size_t count)
+{
+	return write(fd, cmds, count * 4) == (ssize_t) (count * 4) ? 0 : -1;
+}
+
+/* Runs draws of RECT_SIZE squares, each command buffer followed by fsync,
+ * and returns the throughput in pixels per second. */
+static double
+device_rate(int fd, bool blit, int draws)
+{
+	uint32_t cmds[3 * 64];
+	unsigned seed = 1, span = CANVAS_SIZE - RECT_SIZE + 1;
+	int i, count = 0;
+	double start = now();
+
+	for (i = 0; i < draws; ++i) {
+		if (blit)
+			cmds[count++] = V2D_CMD_SRC_POS(rand_r(&seed) % span,
+					rand_r(&seed) % span);
+		else
+			cmds[count++] = V2D_CMD_FILL_COLOR(i & 0xff);
+		cmds[count++] = V2D_CMD_DST_POS(rand_r(&seed) % span,
+				rand_r(&seed) % span);
+		cmds[count++] = blit ? V2D_CMD_DO_BLIT(RECT_SIZE, RECT_SIZE)
+			: V2D_CMD_DO_FILL(RECT_SIZE, RECT_SIZE);
+		if (count == 3 * 64 || i + 1 == draws) {
+			if (submit(fd, cmds, count) || fsync(fd))
+				return -1;
+			count = 0;
+		}
+	}
+	return (double) draws * RECT_SIZE * RECT_SIZE / (now() - start);
+}
+
+static int
+measure(const char *device, int node, int rounds, int draws)
+{
+	struct v2d_ioctl_set_dimensions dim = { CANVAS_SIZE, CANVAS_SIZE };
+	struct v2d_ioctl_node info = { node };
+	size_t size = (size_t) CANVAS_SIZE * CANVAS_SIZE;
+	volatile uint64_t *words;
+	double start, write_bw, read_bw, fill, blit;
+	uint8_t *pixels;
+	int fd, i;
+	size_t j;
+
+	fd = open(device, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		perror(device);
+		return -1;
+	}
+	if (ioctl(fd, V2D_IOCTL_SET_NODE, &info)
+			|| ioctl(fd, V2D_IOCTL_SET_DIMENSIONS, &dim)
+			|| ioctl(fd, V2D_IOCTL_GET_NODE, &info)) {
+		fprintf(stderr, "v2d_numa: node %d: %s\n", node,
+				strerror(errno));
+		close(fd);
+		return -1;
+	}
+	pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (pixels == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return -1;
+	}
+	words = (volatile uint64_t *) pixels;
+
+	/* The first pass faults the pages in. */
+	memset(pixels, 0, size);
+	start = now();
+	for (i = 0; i < rounds; ++i)
+		memset(pixels, i, size);
+	write_bw = rounds * size / (now() - start);
+	start = now();
+	for (i = 0; i < rounds; ++i)
+		for (j = 0; j < size / 8; ++j)
+			(void) words[j];
+	read_bw = rounds * size / (now() - start);
+
+	fill = device_rate(fd, false, draws);
+	blit = device_rate(fd, true, draws);
+
+	printf("%4d %4d %5u/%-5u %9.0f %9.0f %9.1f %9.1f%s\n", node,
+			info.node, info.node_pages, info.pages, write_bw / 1e6,
+			read_bw / 1e6, fill / 1e6, blit / 1e6,
+			fill < 0 || blit < 0 ? "  FAILED" : "");
+	munmap(pixels, size);
+	close(fd);
+	return fill < 0 || blit < 0 ? -1 : 0;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-c cpu node] [-r rounds] "
+			"[-n draws]\n", name);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *device = "/dev/v2d0";
+	int nodes[MAX_NODES], count, opt, i, cpu_node = -1, rounds = 16,
+	    draws = 2000, failed = 0;
+
+	while ((opt = getopt(argc, argv, "d:c:r:n:")) != -1)
+		switch (opt) {
+		case 'd': device = optarg; break;
+		case 'c': cpu_node = atoi(optarg); break;
+		case 'r': rounds = atoi(optarg); break;
+		case 'n': draws = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	if (optind != argc || rounds <= 0 || draws <= 0)
+		usage(argv[0]);
+
+	count = parse_list("/sys/devices/system/node/online", NULL, nodes);
+	if (count <= 0) {
+		nodes[0] = 0;
+		count = 1;
+	}
+	if (cpu_node >= 0 && pin(cpu_node)) {
+		fprintf(stderr, "v2d_numa: cannot run on node %d\n", cpu_node);
+		return 1;
+	}
+
+	if (cpu_node >= 0)
+		printf("running on the CPUs of node %d\n", cpu_node);
+	printf("want node pages       write MB/s read MB/s fill Mpx/s "
+			"blit Mpx/s\n");
+	failed |= measure(device, -1, rounds, draws) != 0;
+	for (i = 0; i < count; ++i)
+		failed |= measure(device, nodes[i], rounds, draws) != 0;
+	return failed;
+}
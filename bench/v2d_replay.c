@@ -0,0 +1,302 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kshim.h"
+#include "v2d_model.h"
+#include "../v2d_ioctl.h"
+
+/* Re-issues a command stream captured in debugfs (v2d/v2dN/ctxM_capture)
+ * against a character device, or by default against the device model, at the
+ * original pace or as fast as possible, and reports the throughput. Commands
+ * are written in the batches of the captured writes, or split into single
+ * commands, or re-batched into writes of a given size. Commands not followed
+ * by a write entry, as in captures taken before writes were recorded, go one
+ * at a time. Ioctls referring to other descriptors (BLIT_FROM, SNAPSHOT,
+ * CANVAS_FD) cannot be reproduced from a single capture and are skipped. */
+
+#define CAPTURE_CMD	0
+#define CAPTURE_IOCTL	1
+#define CAPTURE_FSYNC	2
+#define CAPTURE_WRITE	3
+
+typedef struct {
+	uint64_t ns;
+	unsigned type;
+	unsigned code;
+	uint32_t args[4];
+} entry_t;
+
+typedef struct {
+	ssize_t (*write)(int, const void *, size_t);
+	long (*ioctl)(int, unsigned, void *);
+	int (*fsync)(int);
+	int (*close)(int);
+} backend_t;
+
+static ssize_t
+sys_write(int fd, const void *buf, size_t len)
+{
+	ssize_t ret = write(fd, buf, len);
+
+	return ret < 0 ? -errno : ret;
+}
+
+static long
+sys_ioctl(int fd, unsigned cmd, void *arg)
+{
+	return ioctl(fd, cmd, arg) < 0 ? -errno : 0;
+}
+
+static int
+sys_fsync(int fd)
+{
+	return fsync(fd) < 0 ? -errno : 0;
+}
+
+static const backend_t sys_backend = {
+	sys_write, sys_ioctl, sys_fsync, close
+};
+
+static const backend_t model_backend = {
+	kshim_write, kshim_ioctl, kshim_fsync, kshim_close
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+wait_until(double t)
+{
+	double left = t - now();
+	struct timespec ts;
+
+	if (left <= 0)
+		return;
+	ts.tv_sec = left;
+	ts.tv_nsec = (left - ts.tv_sec) * 1e9;
+	nanosleep(&ts, NULL);
+}
+
+static int
+load(const char *path, entry_t **entries)
+{
+	FILE *f = fopen(path, "r");
+	char line[256], kind[8];
+	int count = 0, capacity = 0;
+	entry_t e, *grown;
+
+	if (!f)
+		return -1;
+	*entries = NULL;
+	while (fgets(line, sizeof(line), f)) {
+		memset(&e, 0, sizeof(e));
+		if (line[0] == '#'
+				|| sscanf(line, "%" SCNu64 " %7s", &e.ns, kind) != 2)
+			continue;
+		if (!strcmp(kind, "cmd")
+				&& sscanf(line, "%*s %*s %x", &e.code) == 1)
+			e.type = CAPTURE_CMD;
+		else if (!strcmp(kind, "ioctl")
+				&& sscanf(line, "%*s %*s %x %x %x %x %x",
+					&e.code, &e.args[0], &e.args[1],
+					&e.args[2], &e.args[3]) == 5)
+			e.type = CAPTURE_IOCTL;
+		else if (!strcmp(kind, "fsync"))
+			e.type = CAPTURE_FSYNC;
+		else if (!strcmp(kind, "write")
+				&& sscanf(line, "%*s %*s %u", &e.code) == 1)
+			e.type = CAPTURE_WRITE;
+		else
+			continue;
+		if (count == capacity) {
+			capacity = capacity ? 2 * capacity : 1024;
+			grown = realloc(*entries, capacity * sizeof(entry_t));
+			if (!grown) {
+				fclose(f);
+				return -1;
+			}
+			*entries = grown;
+		}
+		(*entries)[count++] = e;
+	}
+	fclose(f);
+	return count;
+}
+
+/* Writes count commands, size at a time (0 for all at once), and returns the
+ * number of failed writes. */
+static int
+issue(const backend_t *backend, int fd, uint32_t *cmds, int count, int size,
+		int *writes)
+{
+	int failed = 0, n;
+
+	for (; count > 0; cmds += n, count -= n) {
+		n = size && size < count ? size : count;
+		failed += backend->write(fd, cmds, 4 * n) != 4 * n;
+		++*writes;
+	}
+	return failed;
+}
+
+static int
+compare(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-m] [-p ns per pixel] "
+			"[-s | -r commands per write] capture\n", name);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	const backend_t *backend = &model_backend;
+	const char *device = NULL;
+	bool max_speed = false, split = false;
+	unsigned pixel_ns = 0;
+	v2d_model_t model;
+	entry_t *entries, *e;
+	uint32_t buf[64], *batch;
+	int opt, count, fd, i, n, pending = 0, rebatch = 0, cmds = 0,
+	    draws = 0, writes = 0, ioctls = 0, fsyncs = 0, skipped = 0,
+	    failed = 0;
+	double start, elapsed, t, *latencies;
+	long ret;
+
+	while ((opt = getopt(argc, argv, "d:mp:sr:")) != -1)
+		switch (opt) {
+		case 'd': device = optarg; break;
+		case 'm': max_speed = true; break;
+		case 'p': pixel_ns = atoi(optarg); break;
+		case 's': split = true; break;
+		case 'r': rebatch = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	if (optind + 1 != argc || rebatch < 0 || (split && rebatch))
+		usage(argv[0]);
+	count = load(argv[optind], &entries);
+	if (count <= 0) {
+		fprintf(stderr, "v2d_replay: no entries in %s\n", argv[optind]);
+		return 1;
+	}
+	latencies = calloc(count, sizeof(double));
+	batch = calloc(count, sizeof(uint32_t));
+
+	if (device) {
+		backend = &sys_backend;
+		fd = open(device, O_RDWR);
+	} else if (kshim_module_init() || kshim_add_device(&model)) {
+		fprintf(stderr, "v2d_replay: cannot set up the device\n");
+		return 1;
+	} else {
+		model.pixel_ns = pixel_ns;
+		fd = kshim_open(0);
+	}
+	if (fd < 0) {
+		fprintf(stderr, "v2d_replay: cannot open the device\n");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < count; ++i) {
+		e = &entries[i];
+		if (!max_speed)
+			wait_until(start + (e->ns - entries[0].ns) * 1e-9);
+		/* A command is held until the write entry that follows it. An
+		 * ioctl or fsync first writes any commands still held. */
+		if (e->type == CAPTURE_CMD) {
+			batch[pending++] = e->code;
+			++cmds;
+			switch (V2D_CMD_TYPE(e->code)) {
+			case V2D_CMD_TYPE_DO_BLIT:
+			case V2D_CMD_TYPE_DO_FILL:
+				++draws;
+			}
+			if (split || pending == rebatch) {
+				failed += issue(backend, fd, batch, pending, 0,
+						&writes);
+				pending = 0;
+			}
+			continue;
+		}
+		if (e->type == CAPTURE_WRITE && !rebatch) {
+			n = min((int) e->code, pending);
+			failed += issue(backend, fd, batch, pending - n, 1,
+					&writes);
+			failed += issue(backend, fd, batch + pending - n, n, 0,
+					&writes);
+			pending = 0;
+			continue;
+		}
+		if (e->type == CAPTURE_WRITE)
+			continue;
+		failed += issue(backend, fd, batch, pending, rebatch ? 0 : 1,
+				&writes);
+		pending = 0;
+		switch (e->type) {
+		case CAPTURE_IOCTL:
+			if (e->code == V2D_IOCTL_BLIT_FROM
+					|| e->code == V2D_IOCTL_SNAPSHOT
+					|| e->code == V2D_IOCTL_CANVAS_FD) {
+				++skipped;
+				continue;
+			}
+			/* Arguments the ioctl writes back land in buf. */
+			memset(buf, 0, sizeof(buf));
+			memcpy(buf, e->args, sizeof(e->args));
+			ret = backend->ioctl(fd, e->code, buf);
+			++ioctls;
+			if (e->code == V2D_IOCTL_PATTERN_FILL)
+				++draws;
+			break;
+		default:
+			t = now();
+			ret = backend->fsync(fd);
+			latencies[fsyncs++] = now() - t;
+			break;
+		}
+		if (ret < 0)
+			++failed;
+	}
+	failed += issue(backend, fd, batch, pending, rebatch ? 0 : 1, &writes);
+	if (backend->fsync(fd))
+		++failed;
+	elapsed = now() - start;
+	backend->close(fd);
+	if (!device)
+		kshim_module_exit();
+
+	qsort(latencies, fsyncs, sizeof(double), compare);
+	printf("%d entries: %d cmds, %d draws, %d writes, %d ioctls, "
+			"%d fsyncs, %d skipped, %d failed\n", count, cmds,
+			draws, writes, ioctls, fsyncs, skipped, failed);
+	printf("captured %.3f s, replayed %.3f s%s\n",
+			(entries[count - 1].ns - entries[0].ns) * 1e-9, elapsed,
+			max_speed ? " at maximum speed" : "");
+	printf("%.0f draws/s %.0f cmds/s  fsync us p50 %.0f p90 %.0f "
+			"p99 %.0f\n", draws / elapsed, cmds / elapsed,
+			fsyncs ? latencies[(fsyncs - 1) * 50 / 100] * 1e6 : 0,
+			fsyncs ? latencies[(fsyncs - 1) * 90 / 100] * 1e6 : 0,
+			fsyncs ? latencies[(fsyncs - 1) * 99 / 100] * 1e6 : 0);
+	free(latencies);
+	free(batch);
+	free(entries);
+	return failed != 0;
+}
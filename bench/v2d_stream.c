@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kshim.h"
+#include "v2d_model.h"
+#include "../v2d_ioctl.h"
+#include "../vintage2d.h"
+
+/* Compares moving pixels through the descriptor of V2D_IOCTL_CANVAS_FD
+ * (pread, pwrite and splice to a pipe) with memcpy through
+ * a mapping, for the full canvas and for strips of rows at random heights.
+ * Every transfer follows a fill, so it has to wait for the device: reads and
+ * writes of the descriptor do it themselves, a mapping needs fsync first. Runs
+ * against the device model, or with -d against a character device. */
+
+typedef struct {
+	long (*ioctl)(int, unsigned, void *);
+	ssize_t (*write)(int, const void *, size_t);
+	int (*fsync)(int);
+	ssize_t (*pread)(int, void *, size_t, loff_t);
+	ssize_t (*pwrite)(int, const void *, size_t, loff_t);
+	/* Splices up to len bytes at *pos into an empty pipe and drains it. */
+	ssize_t (*splice)(int, loff_t *, size_t);
+	int (*close)(int);
+} backend_t;
+
+static int null_fd, pipe_fds[2];
+
+/* The pipe of the model has the default capacity of a pipe, 16 pages. */
+#define MODEL_PIPE_SIZE		(16 * 4096)
+
+static uint8_t model_pipe[MODEL_PIPE_SIZE];
+
+static long
+sys_ioctl(int fd, unsigned cmd, void *arg)
+{
+	long ret = ioctl(fd, cmd, arg);
+
+	return ret < 0 ? -errno : ret;
+}
+
+static ssize_t
+sys_write(int fd, const void *buf, size_t len)
+{
+	ssize_t ret = write(fd, buf, len);
+
+	return ret < 0 ? -errno : ret;
+}
+
+static int
+sys_fsync(int fd)
+{
+	return fsync(fd) < 0 ? -errno : 0;
+}
+
+static ssize_t
+sys_pread(int fd, void *buf, size_t len, loff_t pos)
+{
+	ssize_t ret = pread(fd, buf, len, pos);
+
+	return ret < 0 ? -errno : ret;
+}
+
+static ssize_t
+sys_pwrite(int fd, const void *buf, size_t len, loff_t pos)
+{
+	ssize_t ret = pwrite(fd, buf, len, pos);
+
+	return ret < 0 ? -errno : ret;
+}
+
+static ssize_t
+sys_splice(int fd, loff_t *pos, size_t len)
+{
+	ssize_t in, out, left;
+
+	in = splice(fd, pos, pipe_fds[1], NULL, len, SPLICE_F_MOVE);
+	if (in < 0)
+		return -errno;
+	for (left = in; left > 0; left -= out) {
+		out = splice(pipe_fds[0], NULL, null_fd, NULL, left,
+				SPLICE_F_MOVE);
+		if (out <= 0)
+			return out < 0 ? -errno : -EIO;
+	}
+	return in;
+}
+
+static ssize_t
+model_splice(int fd, loff_t *pos, size_t len)
+{
+	return kshim_splice(fd, pos, model_pipe, MODEL_PIPE_SIZE, len);
+}
+
+static const backend_t sys_backend = {
+	sys_ioctl, sys_write, sys_fsync, sys_pread, sys_pwrite, sys_splice,
+	close
+};
+
+static const backend_t model_backend = {
+	kshim_ioctl, kshim_write, kshim_fsync, kshim_pread, kshim_pwrite,
+	model_splice, kshim_close
+};
+
+static const backend_t *backend = &model_backend;
+static const char *device;
+static unsigned size = 2048;
+static unsigned strip = 64;
+static int rounds = 50;
+
+/* Pages of the mapping of the canvas. */
+static uint8_t **pages;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+map(int fd, unsigned count)
+{
+	uint8_t *base = NULL;
+	unsigned i;
+
+	pages = calloc(count, sizeof(uint8_t *));
+	if (!pages)
+		return -1;
+	if (device) {
+		base = mmap(NULL, (size_t) count * VINTAGE2D_PAGE_SIZE,
+				PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (base == MAP_FAILED)
+			return -1;
+	}
+	for (i = 0; i < count; ++i) {
+		pages[i] = device ? base + (size_t) i * VINTAGE2D_PAGE_SIZE
+			: kshim_fault(fd, i);
+		if (!pages[i])
+			return -1;
+	}
+	return 0;
+}
+
+static void
+map_copy(size_t offset, uint8_t *buf, size_t len, bool write)
+{
+	size_t chunk;
+	uint8_t *p;
+
+	while (len > 0) {
+		chunk = min(len, VINTAGE2D_PAGE_SIZE
+				- offset % VINTAGE2D_PAGE_SIZE);
+		p = pages[offset / VINTAGE2D_PAGE_SIZE]
+			+ offset % VINTAGE2D_PAGE_SIZE;
+		if (write)
+			memcpy(p, buf, chunk);
+		else
+			memcpy(buf, p, chunk);
+		offset += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+}
+
+/* Moves len bytes at offset out of the canvas through the pipe. */
+static int
+splice_out(int cfd, size_t offset, size_t len)
+{
+	loff_t pos = offset;
+	ssize_t in;
+
+	while (len > 0) {
+		in = backend->splice(cfd, &pos, len);
+		if (in <= 0)
+			return -1;
+		len -= in;
+	}
+	return 0;
+}
+
+enum method { PREAD, PWRITE, MMAP_READ, MMAP_WRITE, SPLICE };
+
+static const char *method_names[] = {
+	"pread", "pwrite", "mmap read", "mmap write", "splice"
+};
+
+/* Returns the throughput in MB/s, or a negative value on an error. */
+static double
+run(int fd, int cfd, enum method method, size_t len, uint8_t *buf)
+{
+	unsigned cmds[3], seed = 1;
+	size_t offset = 0, total = (size_t) size * size;
+	double start = now(), elapsed;
+	int i, ret = 0;
+
+	cmds[1] = V2D_CMD_DST_POS(0, 0);
+	cmds[2] = V2D_CMD_DO_FILL(size, size);
+	for (i = 0; i < rounds && !ret; ++i) {
+		cmds[0] = V2D_CMD_FILL_COLOR(i & 0xff);
+		if (backend->write(fd, cmds, sizeof(cmds)) != sizeof(cmds))
+			return -1;
+		if (len < total)
+			offset = (size_t) (rand_r(&seed)
+					% (size - len / size + 1)) * size;
+		switch (method) {
+		case PREAD:
+			ret = backend->pread(cfd, buf, len, offset)
+				!= (ssize_t) len;
+			break;
+		case PWRITE:
+			ret = backend->pwrite(cfd, buf, len, offset)
+				!= (ssize_t) len;
+			break;
+		case MMAP_READ:
+		case MMAP_WRITE:
+			ret = backend->fsync(fd);
+			map_copy(offset, buf, len, method == MMAP_WRITE);
+			break;
+		case SPLICE:
+			ret = splice_out(cfd, offset, len);
+			break;
+		}
+	}
+	/* Writes through the mapping are complete at once, but the others
+	 * are timed up to the same point. */
+	if (backend->fsync(fd))
+		ret = -1;
+	elapsed = now() - start;
+	return ret ? -1 : rounds * len / elapsed / 1e6;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-s canvas size] "
+			"[-r strip rows] [-n rounds] [-p ns per pixel]\n", name);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct v2d_ioctl_set_dimensions dim;
+	size_t lens[2];
+	unsigned pixel_ns = 0;
+	v2d_model_t model;
+	uint8_t *buf;
+	int opt, fd, cfd, i, m, failed = 0;
+	double rate;
+
+	while ((opt = getopt(argc, argv, "d:s:r:n:p:")) != -1)
+		switch (opt) {
+		case 'd': device = optarg; break;
+		case 's': size = atoi(optarg); break;
+		case 'r': strip = atoi(optarg); break;
+		case 'n': rounds = atoi(optarg); break;
+		case 'p': pixel_ns = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	if (optind != argc || size == 0 || size > 2048 || strip == 0
+			|| strip > size || rounds <= 0)
+		usage(argv[0]);
+	dim.height = dim.width = size;
+	lens[0] = (size_t) size * size;
+	lens[1] = (size_t) strip * size;
+
+	if (device) {
+		backend = &sys_backend;
+		fd = open(device, O_RDWR);
+		null_fd = open("/dev/null", O_WRONLY);
+		if (null_fd < 0 || pipe(pipe_fds)) {
+			perror("v2d_stream");
+			return 1;
+		}
+	} else if (kshim_module_init() || kshim_add_device(&model)) {
+		fprintf(stderr, "v2d_stream: cannot set up the device\n");
+		return 1;
+	} else {
+		model.pixel_ns = pixel_ns;
+		fd = kshim_open(0);
+	}
+	if (fd < 0 || backend->ioctl(fd, V2D_IOCTL_SET_DIMENSIONS, &dim)
+			|| (cfd = backend->ioctl(fd, V2D_IOCTL_CANVAS_FD,
+					NULL)) < 0
+			|| map(fd, DIV_ROUND_UP(lens[0], VINTAGE2D_PAGE_SIZE))) {
+		fprintf(stderr, "v2d_stream: cannot set up the canvas\n");
+		return 1;
+	}
+	buf = malloc(lens[0]);
+	memset(buf, 0x5a, lens[0]);
+
+	printf("%-10s %12s %12s\n", "", "full MB/s", "strip MB/s");
+	for (m = PREAD; m <= SPLICE; ++m) {
+		printf("%-10s", method_names[m]);
+		for (i = 0; i < 2; ++i) {
+			rate = run(fd, cfd, m, lens[i], buf);
+			failed |= rate < 0;
+			printf(" %12.0f", rate);
+		}
+		printf("\n");
+	}
+	backend->close(cfd);
+	backend->close(fd);
+	if (!device)
+		kshim_module_exit();
+	free(buf);
+	return failed;
+}
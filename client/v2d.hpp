@@ -0,0 +1,584 @@
+#ifndef V2D_HPP
+#define V2D_HPP
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include "../v2d_ioctl.h"
+
+/* Header-only C++17 client of the vintage2d driver: typed commands, RAII
+ * handles of a context and of its mapped canvas, and a command buffer that
+ * records draws without allocating and submits them in batches. Failed system
+ * calls throw std::system_error. */
+
+namespace v2d {
+
+constexpr unsigned max_canvas_size = 2048;
+
+/* Fences a Device keeps waiting for at once, and the size of a callback of
+ * a fence. */
+constexpr std::size_t fence_queue_size = 16;
+constexpr std::size_t fence_callback_size = 8 * sizeof(void *);
+
+inline std::system_error
+system_error(const char *what)
+{
+	return std::system_error(errno, std::generic_category(), what);
+}
+
+/* An encoded command. Arguments out of range throw std::out_of_range, which
+ * in a constant expression is a compile error:
+ *
+ *     constexpr auto fill = v2d::Command::do_fill(64, 64);
+ */
+class Command {
+public:
+	static constexpr Command
+	src_pos(unsigned x, unsigned y)
+	{
+		return Command(V2D_CMD_SRC_POS(pos(x), pos(y)));
+	}
+
+	static constexpr Command
+	dst_pos(unsigned x, unsigned y)
+	{
+		return Command(V2D_CMD_DST_POS(pos(x), pos(y)));
+	}
+
+	static constexpr Command
+	fill_color(unsigned color)
+	{
+		return Command(V2D_CMD_FILL_COLOR(color < 256 ? color
+				: throw std::out_of_range("v2d: color")));
+	}
+
+	static constexpr Command
+	do_fill(unsigned width, unsigned height)
+	{
+		return Command(V2D_CMD_DO_FILL(size(width), size(height)));
+	}
+
+	static constexpr Command
+	do_blit(unsigned width, unsigned height)
+	{
+		return Command(V2D_CMD_DO_BLIT(size(width), size(height)));
+	}
+
+	constexpr uint32_t
+	raw() const
+	{
+		return raw_;
+	}
+
+	constexpr unsigned
+	type() const
+	{
+		return V2D_CMD_TYPE(raw_);
+	}
+
+private:
+	constexpr explicit Command(uint32_t raw) : raw_(raw) {}
+
+	static constexpr unsigned
+	pos(unsigned v)
+	{
+		return v < max_canvas_size ? v
+			: throw std::out_of_range("v2d: position");
+	}
+
+	static constexpr unsigned
+	size(unsigned v)
+	{
+		return v > 0 && v <= max_canvas_size ? v
+			: throw std::out_of_range("v2d: size");
+	}
+
+	uint32_t raw_;
+};
+
+/* An open context of the device. */
+class Device {
+public:
+	explicit Device(const char *path = "/dev/v2d0")
+		: fd_(::open(path, O_RDWR | O_CLOEXEC))
+	{
+		if (fd_ < 0)
+			throw system_error("open");
+	}
+
+	Device(Device &&other) noexcept
+		: fd_(std::exchange(other.fd_, -1)),
+		  waiter_(std::move(other.waiter_)) {}
+
+	Device &
+	operator=(Device &&other) noexcept
+	{
+		if (this != &other) {
+			close();
+			fd_ = std::exchange(other.fd_, -1);
+			waiter_ = std::move(other.waiter_);
+		}
+		return *this;
+	}
+
+	Device(const Device &) = delete;
+	Device &operator=(const Device &) = delete;
+
+	/* Waits for the fences still queued. */
+	~Device()
+	{
+		close();
+	}
+
+	int
+	fd() const
+	{
+		return fd_;
+	}
+
+	/* A short write stops at the first rejected command; writing from
+	 * there reports its error. */
+	void
+	submit(const uint32_t *cmds, std::size_t count)
+	{
+		ssize_t written;
+
+		while (count > 0) {
+			written = ::write(fd_, cmds, count * sizeof(uint32_t));
+			if (written < 0)
+				throw system_error("write");
+			cmds += written / sizeof(uint32_t);
+			count -= written / sizeof(uint32_t);
+		}
+	}
+
+	void
+	submit(Command cmd)
+	{
+		uint32_t raw = cmd.raw();
+
+		submit(&raw, 1);
+	}
+
+	void
+	sync()
+	{
+		if (::fsync(fd_))
+			throw system_error("fsync");
+	}
+
+	/* The fence is reached once the device has executed every command
+	 * submitted before it. Fences are waited for in order by one thread
+	 * of the device, started by the first fence; one fsync completes all
+	 * fences queued before it. With fence_queue_size fences outstanding,
+	 * the next one waits for a free place. The future holds the only
+	 * allocation of a fence; dropping it does not block. */
+	std::future<void>
+	fence()
+	{
+		std::promise<void> promise;
+		std::future<void> future = promise.get_future();
+
+		enqueue([&](Fence &slot) {
+			slot.promise.emplace(std::move(promise));
+		});
+		return future;
+	}
+
+	/* As above, calling back on the waiting thread with the result
+	 * instead, without allocating. The callback, stored in the queue,
+	 * must fit in fence_callback_size and must not throw. */
+	template <class Callback>
+	void
+	fence(Callback callback)
+	{
+		static_assert(sizeof(Callback) <= fence_callback_size
+				&& alignof(Callback) <= alignof(std::max_align_t),
+				"v2d: the fence callback is too large");
+
+		enqueue([&](Fence &slot) {
+			new (slot.storage) Callback(std::move(callback));
+			slot.call = [](void *p, std::error_code error) {
+				Callback *callback = static_cast<Callback *>(p);
+
+				(*callback)(error);
+				callback->~Callback();
+			};
+		});
+	}
+
+private:
+	struct Fence {
+		std::optional<std::promise<void>> promise;
+		void (*call)(void *, std::error_code) = nullptr;
+		alignas(std::max_align_t) unsigned char
+			storage[fence_callback_size];
+	};
+
+	/* The queue is a ring of fences. The thread completes the first count
+	 * fences and only then frees their places. */
+	struct Waiter {
+		explicit Waiter(int fd) : fd(fd), thread(&Waiter::run, this) {}
+
+		~Waiter()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stop = true;
+			}
+			queued.notify_one();
+			thread.join();
+		}
+
+		void
+		run()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			std::size_t n, i;
+			int error;
+
+			for (;;) {
+				queued.wait(lock, [this] {
+					return count > 0 || stop;
+				});
+				if (count == 0)
+					return;
+				n = count;
+				lock.unlock();
+				error = ::fsync(fd) ? errno : 0;
+				for (i = 0; i < n; ++i)
+					complete(fences[(head + i)
+							% fence_queue_size],
+							error);
+				lock.lock();
+				head = (head + n) % fence_queue_size;
+				count -= n;
+				freed.notify_all();
+			}
+		}
+
+		static void
+		complete(Fence &fence, int error)
+		{
+			if (fence.call) {
+				fence.call(fence.storage, std::error_code(
+						error, std::generic_category()));
+				fence.call = nullptr;
+				return;
+			}
+			if (error)
+				fence.promise->set_exception(
+					std::make_exception_ptr(
+						std::system_error(error,
+							std::generic_category(),
+							"fsync")));
+			else
+				fence.promise->set_value();
+			fence.promise.reset();
+		}
+
+		int fd;
+		std::mutex mutex;
+		std::condition_variable queued;
+		std::condition_variable freed;
+		std::array<Fence, fence_queue_size> fences;
+		std::size_t head = 0;
+		std::size_t count = 0;
+		bool stop = false;
+		std::thread thread;
+	};
+
+	/* Fills the next free place of the queue with make. */
+	template <class Make>
+	void
+	enqueue(Make make)
+	{
+		if (!waiter_)
+			waiter_ = std::make_unique<Waiter>(fd_);
+
+		Waiter &w = *waiter_;
+		std::unique_lock<std::mutex> lock(w.mutex);
+
+		w.freed.wait(lock, [&w] {
+			return w.count < fence_queue_size;
+		});
+		make(w.fences[(w.head + w.count) % fence_queue_size]);
+		++w.count;
+		lock.unlock();
+		w.queued.notify_one();
+	}
+
+	void
+	close()
+	{
+		waiter_.reset();
+		if (fd_ >= 0)
+			::close(fd_);
+	}
+
+	int fd_;
+	std::unique_ptr<Waiter> waiter_;
+};
+
+/* The canvas of a context, sized with V2D_IOCTL_SET_DIMENSIONS and mapped
+ * for the CPU. Pixels drawn by the device are visible after a fence. Given a
+ * fill color, the canvas is filled by the device rather than cleared. */
+class Canvas {
+public:
+	Canvas(Device device, uint16_t width, uint16_t height,
+			std::optional<uint8_t> fill = std::nullopt)
+		: device_(std::move(device)), width_(width), height_(height),
+		  size_(std::size_t(width) * height)
+	{
+		struct v2d_ioctl_set_dimensions dim = { height, width };
+		struct v2d_ioctl_set_dimensions_fill dim_fill = { height, width,
+			fill.value_or(0), {} };
+		void *pixels;
+
+		if (fill) {
+			if (::ioctl(device_.fd(), V2D_IOCTL_SET_DIMENSIONS_FILL,
+						&dim_fill))
+				throw system_error(
+					"V2D_IOCTL_SET_DIMENSIONS_FILL");
+		} else if (::ioctl(device_.fd(), V2D_IOCTL_SET_DIMENSIONS,
+					&dim)) {
+			throw system_error("V2D_IOCTL_SET_DIMENSIONS");
+		}
+		pixels = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+				MAP_SHARED, device_.fd(), 0);
+		if (pixels == MAP_FAILED)
+			throw system_error("mmap");
+		pixels_ = static_cast<uint8_t *>(pixels);
+	}
+
+	Canvas(Canvas &&other) noexcept
+		: device_(std::move(other.device_)), width_(other.width_),
+		  height_(other.height_), size_(other.size_),
+		  pixels_(std::exchange(other.pixels_, nullptr)) {}
+
+	Canvas &operator=(Canvas &&) = delete;
+	Canvas(const Canvas &) = delete;
+	Canvas &operator=(const Canvas &) = delete;
+
+	~Canvas()
+	{
+		if (pixels_)
+			::munmap(pixels_, size_);
+	}
+
+	/* Keeps the common top-left rectangle if preserve is set, otherwise
+	 * clears the canvas. Invalidates pointers to its pixels. */
+	void
+	resize(uint16_t width, uint16_t height, bool preserve = true)
+	{
+		struct v2d_ioctl_resize resize = { height, width,
+			preserve ? V2D_RESIZE_PRESERVE : 0u };
+		std::size_t size = std::size_t(width) * height;
+		void *pixels;
+
+		if (::ioctl(device_.fd(), V2D_IOCTL_RESIZE, &resize))
+			throw system_error("V2D_IOCTL_RESIZE");
+		::munmap(pixels_, size_);
+		pixels_ = nullptr;
+		pixels = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, device_.fd(), 0);
+		if (pixels == MAP_FAILED)
+			throw system_error("mmap");
+		pixels_ = static_cast<uint8_t *>(pixels);
+		width_ = width;
+		height_ = height;
+		size_ = size;
+	}
+
+	Device &
+	device()
+	{
+		return device_;
+	}
+
+	unsigned
+	width() const
+	{
+		return width_;
+	}
+
+	unsigned
+	height() const
+	{
+		return height_;
+	}
+
+	/* Rows are width bytes apart. */
+	uint8_t *
+	pixels()
+	{
+		return pixels_;
+	}
+
+	uint8_t *
+	row(unsigned y)
+	{
+		return pixels_ + std::size_t(y) * width_;
+	}
+
+private:
+	Device device_;
+	uint16_t width_;
+	uint16_t height_;
+	std::size_t size_;
+	uint8_t *pixels_ = nullptr;
+};
+
+/* Records draws into a preallocated buffer of N commands, reused after every
+ * flush. The context keeps the last position and color set, so commands
+ * setting what it already has are dropped. The buffer is flushed with one
+ * write when full, on flush() and on fence(). */
+template <std::size_t N = 1024>
+class CommandBuffer {
+	static_assert(N >= 3, "v2d: a draw takes up to three commands");
+
+public:
+	explicit CommandBuffer(Device &device) : device_(device) {}
+
+	explicit CommandBuffer(Canvas &canvas) : device_(canvas.device()) {}
+
+	CommandBuffer(const CommandBuffer &) = delete;
+	CommandBuffer &operator=(const CommandBuffer &) = delete;
+
+	CommandBuffer &
+	fill(unsigned x, unsigned y, unsigned width, unsigned height,
+			unsigned color)
+	{
+		reserve(3);
+		record(Command::fill_color(color));
+		record(Command::dst_pos(x, y));
+		record(Command::do_fill(width, height));
+		return *this;
+	}
+
+	CommandBuffer &
+	blit(unsigned src_x, unsigned src_y, unsigned dst_x, unsigned dst_y,
+			unsigned width, unsigned height)
+	{
+		reserve(3);
+		record(Command::src_pos(src_x, src_y));
+		record(Command::dst_pos(dst_x, dst_y));
+		record(Command::do_blit(width, height));
+		return *this;
+	}
+
+	CommandBuffer &
+	push(Command cmd)
+	{
+		reserve(1);
+		record(cmd);
+		return *this;
+	}
+
+	/* After an error the state of the context is unknown, so it is set
+	 * again by the following draws. */
+	void
+	flush()
+	{
+		std::size_t count = std::exchange(size_, 0);
+
+		try {
+			device_.submit(cmds_.data(), count);
+		} catch (...) {
+			invalidate();
+			throw;
+		}
+	}
+
+	std::future<void>
+	fence()
+	{
+		flush();
+		return device_.fence();
+	}
+
+	template <class Callback>
+	void
+	fence(Callback callback)
+	{
+		flush();
+		device_.fence(std::move(callback));
+	}
+
+	/* To be called when commands reach the context past this buffer. */
+	void
+	invalidate()
+	{
+		state_.fill(0);
+	}
+
+	std::size_t
+	size() const
+	{
+		return size_;
+	}
+
+	static constexpr std::size_t
+	capacity()
+	{
+		return N;
+	}
+
+private:
+	void
+	reserve(std::size_t count)
+	{
+		if (size_ + count > N)
+			flush();
+	}
+
+	void
+	record(Command cmd)
+	{
+		uint32_t *state = nullptr;
+
+		switch (cmd.type()) {
+		case V2D_CMD_TYPE_SRC_POS:
+			state = &state_[0];
+			break;
+		case V2D_CMD_TYPE_DST_POS:
+			state = &state_[1];
+			break;
+		case V2D_CMD_TYPE_FILL_COLOR:
+			state = &state_[2];
+			break;
+		}
+		if (state) {
+			if (*state == cmd.raw())
+				return;
+			*state = cmd.raw();
+		}
+		cmds_[size_++] = cmd.raw();
+	}
+
+	Device &device_;
+	std::array<uint32_t, N> cmds_;
+	std::size_t size_ = 0;
+	std::array<uint32_t, 3> state_ = {};
+};
+
+}
+
+#endif
@@ -1,21 +1,73 @@
 #include "common.h"
 
-int
-dma_addr_mapping_initialize(dma_addr_mapping_t *dam, v2d_device_t *dev)
+static int
+alloc_coherent(dma_addr_mapping_t *dam, v2d_device_t *dev, bool zero)
 {
 	dam->addr = dma_alloc_coherent(&(dev->dev->dev),
 			VINTAGE2D_PAGE_SIZE, &dam->dma_handle, GFP_KERNEL);
+	dam->page = NULL;
 	if (!dam->addr) {
 		dam->dma_handle = 0;
 		return -1;
 	}
-	memset(dam->addr, 0, VINTAGE2D_PAGE_SIZE);
+	if (zero)
+		memset(dam->addr, 0, VINTAGE2D_PAGE_SIZE);
 	return 0;
 }
 
+int
+dma_addr_mapping_initialize(dma_addr_mapping_t *dam, v2d_device_t *dev)
+{
+	return alloc_coherent(dam, dev, true);
+}
+
+/* Coherent memory always comes from the node of the device. Elsewhere a page
+ * is mapped for streaming DMA, which is coherent as well on x86, the only
+ * platform the override is used on. The device addresses 32 bits and
+ * ZONE_DMA32 need not span the node, so the page may still land on another
+ * one. */
+int
+dma_addr_mapping_initialize_node(dma_addr_mapping_t *dam, v2d_device_t *dev,
+		int node, bool zero)
+{
+	struct page *page;
+
+	if (!IS_ENABLED(CONFIG_X86) || node == NUMA_NO_NODE
+			|| node == dev->node)
+		return alloc_coherent(dam, dev, zero);
+	page = alloc_pages_node(node, GFP_KERNEL | GFP_DMA32
+			| (zero ? __GFP_ZERO : 0), 0);
+	if (!page)
+		return -1;
+	dam->dma_handle = dma_map_page(&(dev->dev->dev), page, 0,
+			VINTAGE2D_PAGE_SIZE, DMA_BIDIRECTIONAL);
+	if (dma_mapping_error(&(dev->dev->dev), dam->dma_handle)) {
+		__free_page(page);
+		dam->dma_handle = 0;
+		return -1;
+	}
+	dam->page = page;
+	dam->addr = page_address(page);
+	return 0;
+}
+
+struct page *
+dma_addr_mapping_page(dma_addr_mapping_t *dam)
+{
+	if (dam->page)
+		return dam->page;
+	return pfn_to_page(__pa(dam->addr) >> PAGE_SHIFT);
+}
+
 void
 dma_addr_mapping_finalize(dma_addr_mapping_t *dam, v2d_device_t *dev)
 {
+	if (dam->page) {
+		dma_unmap_page(&(dev->dev->dev), dam->dma_handle,
+				VINTAGE2D_PAGE_SIZE, DMA_BIDIRECTIONAL);
+		__free_page(dam->page);
+		return;
+	}
 	dma_free_coherent(&(dev->dev->dev), VINTAGE2D_PAGE_SIZE,
 			dam->addr, dam->dma_handle);
 }
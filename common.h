@@ -1,15 +1,31 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <linux/anon_inodes.h>
 #include <linux/cdev.h>
+#include <linux/debugfs.h>
+#include <linux/dma-mapping.h>
+#include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/gcd.h>
+#include <linux/idr.h>
 #include <linux/interrupt.h>
 #include <linux/kernel.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/nodemask.h>
+#include <linux/pagemap.h>
 #include <linux/pci.h>
+#include <linux/pfn_t.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/types.h>
+#include <linux/uio.h>
+#include <linux/vmalloc.h>
 #include <linux/wait.h>
 
 #include "v2d_ioctl.h"
@@ -18,20 +34,63 @@
 #define MIN_CANVAS_SIZE 1
 #define MAX_CANVAS_SIZE 2048
 #define CMDS_SIZE (VINTAGE2D_PAGE_SIZE / 4)
+#define V2D_WRITE_BATCH 64
+#define V2D_STREAM_CHUNK (16 * VINTAGE2D_PAGE_SIZE)
 #define PTABLE_TOC_SIZE \
 	(MAX_CANVAS_SIZE * MAX_CANVAS_SIZE / VINTAGE2D_PAGE_SIZE)
 
 #define DEV_CMDS_ADDR(v2d_dev) ((unsigned*) v2d_dev->cmds.addr)
 #define DEV_CMDS_DMA(v2d_dev) ((unsigned) v2d_dev->cmds.dma_handle)
 
+#define V2D_STATS_CMD_TYPES 8
+#define V2D_STATS_ERRORS 4
+#define V2D_STATS_SYNC_BUCKETS 16
+
 typedef unsigned v2d_cmd_t;
 
+/* Pages allocated on a node other than the device's are mapped for streaming
+ * DMA and kept in page, which is NULL for coherent ones. */
 typedef struct {
 	void *addr;
 	dma_addr_t dma_handle;
+	struct page *page;
 } dma_addr_mapping_t;
 
+typedef struct {
+	u64 cmds[V2D_STATS_CMD_TYPES];
+	u64 bytes;
+	u64 context_switches;
+	u64 ring_full;
+	u64 ring_wait_ns;
+	u64 irqs;
+	u64 errors[V2D_STATS_ERRORS];
+	u64 recoveries;
+	u64 sync_us[V2D_STATS_SYNC_BUCKETS];
+} v2d_stats_t;
+
+/* The last SRC_POS, DST_POS and FILL_COLOR of a context, 0 until set. */
+#define V2D_STATE_CMDS 3
+#define V2D_STATE_INDEX(type) (((type) - V2D_CMD_TYPE_SRC_POS) >> 2)
+
+#define V2D_CAPTURE_ARGS 4
+
+typedef struct {
+	u64 ns;
+	uint32_t type;
+	uint32_t code;
+	uint32_t args[V2D_CAPTURE_ARGS];
+} v2d_capture_entry_t;
+
+typedef struct {
+	unsigned size;
+	unsigned head;
+	unsigned count;
+	u64 dropped;
+	v2d_capture_entry_t entries[];
+} v2d_capture_t;
+
 struct v2d_context;
+struct v2d_snapshot;
 
 typedef struct {
 	struct mutex mutex;
@@ -39,32 +98,85 @@ typedef struct {
 
 	struct v2d_context *ctx;
 
+	/* Held by the driver until removal and by every open context. */
+	struct kref kref;
+	struct rcu_head rcu;
+	/* Set before removal takes the mutex, so contexts fail fast. */
+	bool removed;
+	/* Set under the mutex once a removed device is stopped. */
+	bool quiesced;
+
 	int minor;
 	struct pci_dev *dev;
 	struct cdev *cdev;
 	void __iomem *control;
+	int node;
+	/* Error interrupts since the device was last recovered. */
+	unsigned error;
 
 	dma_addr_mapping_t cmds;
+
+	unsigned src_tlb_tag;
+	unsigned dst_tlb_tag;
+
+	v2d_stats_t stats;
+	struct dentry *debugfs;
 } v2d_device_t;
 
 typedef struct v2d_context {
 	struct mutex mutex;
 
 	v2d_device_t *dev;
+	struct file *file;
 
 	uint16_t width;
 	uint16_t height;
+	int node;
+	/* -EIO if commands were lost since the last fsync, under dev->mutex. */
+	int error;
+	/* The color of a fill of the canvas queued on creation that the CPU
+	 * must not see past, -1 if none, under dev->mutex. */
+	int clear_color;
 	int canvas_pages_count;
 	dma_addr_mapping_t canvas_page_table;
 	dma_addr_mapping_t *canvas_pages;
 
-	v2d_cmd_t history[2];
-	int history_it;
+	v2d_cmd_t state[V2D_STATE_CMDS];
+
+	uint32_t damage[V2D_DAMAGE_TILES];
+
+	struct v2d_snapshot *snapshot;
+	unsigned long *shared;
+
+	struct v2d_ioctl_tlb_stats tlb_stats;
+
+	v2d_stats_t stats;
+	struct dentry *debugfs;
+
+	v2d_capture_t *capture;
+	struct dentry *capture_debugfs;
 } v2d_context_t;
 
+typedef struct v2d_snapshot {
+	v2d_context_t *ctx;
+
+	int canvas_pages_count;
+	dma_addr_mapping_t *canvas_pages;
+} v2d_snapshot_t;
+
 int
 dma_addr_mapping_initialize(dma_addr_mapping_t *dam, v2d_device_t *dev);
 
+/* Unless zero is set, the page is not cleared here. dma_alloc_coherent may
+ * clear it anyway, as it always does on x86; only a page from another node is
+ * sure to be left as allocated. */
+int
+dma_addr_mapping_initialize_node(dma_addr_mapping_t *dam, v2d_device_t *dev,
+		int node, bool zero);
+
+struct page *
+dma_addr_mapping_page(dma_addr_mapping_t *dam);
+
 void
 dma_addr_mapping_finalize(dma_addr_mapping_t *dam, v2d_device_t *dev);
 
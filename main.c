@@ -1,12 +1,34 @@
 #include "common.h"
+#include "v2d_capture.h"
 #include "v2d_device.h"
 #include "v2d_context.h"
+#include "v2d_snapshot.h"
+#include "v2d_stats.h"
+#include "v2d_tlb.h"
+
+#define CREATE_TRACE_POINTS
+#include "v2d_trace.h"
 
 MODULE_LICENSE("GPL");
 
 int max_devices = 256;
 module_param(max_devices, int, 0);
 
+bool tlb_split = false;
+module_param(tlb_split, bool, 0644);
+
+bool tlb_poll = false;
+module_param(tlb_poll, bool, 0644);
+
+bool stats = true;
+module_param(stats, bool, 0644);
+
+unsigned capture = 0;
+module_param(capture, uint, 0644);
+
+unsigned watchdog_ms = 1000;
+module_param(watchdog_ms, uint, 0644);
+
 static struct pci_device_id v2d_ids[] = {
 	{ PCI_DEVICE(VINTAGE2D_VENDOR_ID, VINTAGE2D_DEVICE_ID), },
 	{ 0, }
@@ -16,9 +38,18 @@ MODULE_DEVICE_TABLE(pci, v2d_ids);
 
 static dev_t devno;
 static struct class *class;
-static v2d_device_t *devices;
+static v2d_devices_t devices;
+static struct dentry *debugfs;
+static atomic_t contexts = ATOMIC_INIT(0);
 
 /* helpers *******************************************************************/
+/* Set once, before v2d_remove takes the device lock. */
+static inline bool
+device_removed(v2d_device_t *dev)
+{
+	return READ_ONCE(dev->removed);
+}
+
 static inline unsigned
 get_registry(v2d_device_t *dev, unsigned offset)
 {
@@ -82,12 +113,140 @@ cmds_count(v2d_device_t *dev)
 	return r <= w ? w - r : w + (CMDS_SIZE - 1 - r);
 }
 
+/* The canvas must not be seen as allocated, so a fill queued on its creation
+ * that the device will not complete is done by the CPU. */
+static void
+abandon_clear(v2d_context_t *ctx)
+{
+	if (ctx->clear_color >= 0)
+		v2d_context_fill(ctx, ctx->clear_color);
+	ctx->clear_color = -1;
+}
+
+/* The ring only ever holds commands of dev->ctx, since switching contexts
+ * synchronizes the device, so that context alone loses work. It is told at
+ * its next fsync; contexts waiting for the device go on once it is ready. */
+static void
+device_recover(v2d_device_t *dev)
+{
+	v2d_context_t *ctx = dev->ctx;
+
+	printk(KERN_WARNING "v2d: v2d%d recovering after %s\n", dev->minor,
+			dev->error ? "an error" : "a timeout");
+	trace_v2d_recover(dev->minor, dev->error, ctx);
+	device_reset(dev);
+	synchronize_irq(dev->dev->irq);
+	dev->error = 0;
+	device_prepare(dev);
+	dev->src_tlb_tag = dev->dst_tlb_tag = 0;
+	if (stats) {
+		++dev->stats.recoveries;
+		if (ctx)
+			++ctx->stats.recoveries;
+	}
+	if (ctx) {
+		ctx->error = -EIO;
+		abandon_clear(ctx);
+	}
+	dev->ctx = NULL;
+}
+
+/* Called with the device locked once it is removed. The device is stopped
+ * before the caller goes on, since it may free memory the device still reads,
+ * and the context whose commands are lost is abandoned. */
 static void
+device_quiesce(v2d_device_t *dev)
+{
+	if (!dev->quiesced) {
+		device_reset(dev);
+		synchronize_irq(dev->dev->irq);
+		dev->quiesced = true;
+	}
+	if (dev->ctx)
+		abandon_clear(dev->ctx);
+	dev->ctx = NULL;
+}
+
+static bool
+ring_has_space(v2d_device_t *dev, unsigned unused)
+{
+	return cmds_count(dev) + 1 < CMDS_SIZE - 1;
+}
+
+static bool
+counter_reached(v2d_device_t *dev, unsigned marker)
+{
+	return get_registry(dev, VINTAGE2D_COUNTER) == marker;
+}
+
+/* Waits until done, unless the device reports an error or neither fetches
+ * nor draws for watchdog_ms, in which case it is recovered, or is removed, in
+ * which case it is quiesced. */
+static int
+wait_device(v2d_device_t *dev, bool (*done)(v2d_device_t *, unsigned),
+		unsigned arg)
+{
+	long timeout = watchdog_ms ? msecs_to_jiffies(watchdog_ms)
+		: MAX_SCHEDULE_TIMEOUT;
+	unsigned read, left;
+
+	do {
+		read = get_registry(dev, VINTAGE2D_CMD_READ_PTR);
+		left = get_registry(dev, VINTAGE2D_DRAW_LEFT);
+		if (wait_event_timeout(dev->queue, done(dev, arg)
+					|| READ_ONCE(dev->error)
+					|| device_removed(dev), timeout)
+				&& !READ_ONCE(dev->error)
+				&& !device_removed(dev))
+			return 0;
+	} while (!READ_ONCE(dev->error) && !device_removed(dev)
+			&& (get_registry(dev, VINTAGE2D_CMD_READ_PTR) != read
+			|| get_registry(dev, VINTAGE2D_DRAW_LEFT) != left));
+	if (device_removed(dev)) {
+		device_quiesce(dev);
+		return -ENODEV;
+	}
+	device_recover(dev);
+	return -EIO;
+}
+
+static int
 send_encoded_cmd(v2d_device_t *dev, unsigned cmd)
 {
 	unsigned pos;
+	u64 start, waited;
+	int ret;
 
-	wait_event(dev->queue, cmds_count(dev) + 1 < CMDS_SIZE - 1);
+	if (device_removed(dev)) {
+		device_quiesce(dev);
+		return -ENODEV;
+	}
+	if (READ_ONCE(dev->error)) {
+		device_recover(dev);
+		return -EIO;
+	}
+	if (!ring_has_space(dev, 0)) {
+		start = ktime_get_ns();
+		ret = wait_device(dev, ring_has_space, 0);
+		waited = ktime_get_ns() - start;
+		trace_v2d_ring_full(dev->minor, waited);
+		if (stats) {
+			++dev->stats.ring_full;
+			dev->stats.ring_wait_ns += waited;
+			if (dev->ctx) {
+				++dev->ctx->stats.ring_full;
+				dev->ctx->stats.ring_wait_ns += waited;
+			}
+		}
+		if (ret)
+			return ret;
+	}
+	if (stats) {
+		v2d_stats_cmd(&dev->stats, cmd);
+		if (dev->ctx)
+			v2d_stats_cmd(&dev->ctx->stats, cmd);
+	}
+	trace_v2d_submit(dev->minor, cmd);
 	pos = (get_registry(dev, VINTAGE2D_CMD_WRITE_PTR)
 			- DEV_CMDS_DMA(dev)) / 4;
 	DEV_CMDS_ADDR(dev)[pos++] = cmd;
@@ -95,20 +254,42 @@ send_encoded_cmd(v2d_device_t *dev, unsigned cmd)
 		pos = 0;
 	set_registry(dev, VINTAGE2D_CMD_WRITE_PTR,
 			DEV_CMDS_DMA(dev) + 4 * pos);
+	return 0;
 }
 
-static void
+static int
+set_canvas(v2d_device_t *dev, dma_addr_t page_table, uint16_t width,
+		uint16_t height)
+{
+	set_registry(dev, VINTAGE2D_RESET, VINTAGE2D_RESET_DRAW
+			| VINTAGE2D_RESET_FIFO | VINTAGE2D_RESET_TLB);
+	dev->src_tlb_tag = dev->dst_tlb_tag = 0;
+	if (send_encoded_cmd(dev, VINTAGE2D_CMD_CANVAS_PT(page_table, 1))
+			|| send_encoded_cmd(dev, VINTAGE2D_CMD_CANVAS_DIMS(
+					width, height, 1)))
+		return -EIO;
+	return 0;
+}
+
+static int
 set_context(v2d_context_t *ctx)
 {
 	v2d_device_t *dev = ctx->dev;
 
-	set_registry(dev, VINTAGE2D_RESET, VINTAGE2D_RESET_DRAW
-			| VINTAGE2D_RESET_FIFO | VINTAGE2D_RESET_TLB);
-	send_encoded_cmd(dev, VINTAGE2D_CMD_CANVAS_PT(
-			ctx->canvas_page_table.dma_handle, 1));
-	send_encoded_cmd(dev, VINTAGE2D_CMD_CANVAS_DIMS(
-			ctx->width, ctx->height, 1));
+	trace_v2d_set_context(dev->minor, ctx);
+	if (stats) {
+		++dev->stats.context_switches;
+		++ctx->stats.context_switches;
+	}
 	dev->ctx = ctx;
+	return set_canvas(dev, ctx->canvas_page_table.dma_handle,
+			ctx->width, ctx->height);
+}
+
+static v2d_cmd_t
+last_cmd(v2d_context_t *ctx, unsigned type)
+{
+	return ctx->state[V2D_STATE_INDEX(type)];
 }
 
 static bool
@@ -117,23 +298,11 @@ validate_cmd(v2d_context_t *ctx, v2d_cmd_t cmd)
 	unsigned color = V2D_CMD_COLOR(cmd),
 		x = V2D_CMD_POS_X(cmd), y = V2D_CMD_POS_Y(cmd),
 		width = V2D_CMD_WIDTH(cmd), height = V2D_CMD_HEIGHT(cmd);
-	int i, src=-1, dst=-1, col=-1;
-
-	for (i = 0; i < 2; ++i)
-		switch (V2D_CMD_TYPE(ctx->history[i])) {
-		case V2D_CMD_TYPE_SRC_POS:
-			src = i;
-			break;
-		case V2D_CMD_TYPE_DST_POS:
-			dst = i;
-			break;
-		case V2D_CMD_TYPE_FILL_COLOR:
-			col = i;
-			break;
-		}
+	v2d_cmd_t src = last_cmd(ctx, V2D_CMD_TYPE_SRC_POS),
+		  dst = last_cmd(ctx, V2D_CMD_TYPE_DST_POS),
+		  col = last_cmd(ctx, V2D_CMD_TYPE_FILL_COLOR);
 
 #define assert(cond) if(!(cond)) {return false;};
-#define H(i) (ctx->history[i])
 	switch (V2D_CMD_TYPE(cmd)) {
 	case V2D_CMD_TYPE_SRC_POS:
 		assert(cmd == V2D_CMD_SRC_POS(x, y));
@@ -148,30 +317,29 @@ validate_cmd(v2d_context_t *ctx, v2d_cmd_t cmd)
 		break;
 	case V2D_CMD_TYPE_DO_FILL:
 		assert(cmd == V2D_CMD_DO_FILL(width, height));
-		assert(dst >= 0 && col >= 0);
-		assert(V2D_CMD_POS_X(H(dst)) + width <= ctx->width
-				&& V2D_CMD_POS_Y(H(dst)) + height
+		assert(dst && col);
+		assert(V2D_CMD_POS_X(dst) + width <= ctx->width
+				&& V2D_CMD_POS_Y(dst) + height
 				<= ctx->height);
 		break;
 	case V2D_CMD_TYPE_DO_BLIT:
 		assert(cmd == V2D_CMD_DO_BLIT(width, height));
-		assert(dst >= 0 && src >= 0);
-		assert(V2D_CMD_POS_X(H(dst)) + width <= ctx->width
-				&& V2D_CMD_POS_Y(H(dst)) + height
+		assert(dst && src);
+		assert(V2D_CMD_POS_X(dst) + width <= ctx->width
+				&& V2D_CMD_POS_Y(dst) + height
 				<= ctx->height);
-		assert(V2D_CMD_POS_X(H(src)) + width <= ctx->width
-				&& V2D_CMD_POS_Y(H(src)) + height
+		assert(V2D_CMD_POS_X(src) + width <= ctx->width
+				&& V2D_CMD_POS_Y(src) + height
 				<= ctx->height);
 		break;
 	default:
 		return false;
 	}
 #undef assert
-#undef H
 	return true;
 }
 
-static void
+static int
 send_cmd(v2d_device_t *dev, v2d_cmd_t cmd)
 {
 	unsigned encoded_cmd;
@@ -208,19 +376,203 @@ send_cmd(v2d_device_t *dev, v2d_cmd_t cmd)
 				notify);
 		break;
 	default:
-		return;
+		return 0;
 	}
-	send_encoded_cmd(dev, encoded_cmd);
+	return send_encoded_cmd(dev, encoded_cmd);
 }
 
 static void
-sync_device(v2d_device_t *dev)
+sample_tlb(v2d_context_t *ctx)
+{
+	v2d_device_t *dev = ctx->dev;
+	unsigned src = get_registry(dev, VINTAGE2D_SRC_TLB_TAG),
+		 dst = get_registry(dev, VINTAGE2D_DST_TLB_TAG);
+
+	ctx->tlb_stats.sampled_misses += (src != dev->src_tlb_tag)
+		+ (dst != dev->dst_tlb_tag);
+	dev->src_tlb_tag = src;
+	dev->dst_tlb_tag = dst;
+}
+
+/* A single sample after submission sees at most one change per TLB, usually
+ * of an earlier draw still running. With tlb_poll, a debugging aid, the CPU
+ * instead spins on the tags until the draw is complete, so that every page
+ * held longer than one poll is counted. The watchdog bounds the spinning,
+ * after which wait_device handles the failure. */
+static int
+poll_tlb(v2d_context_t *ctx)
 {
+	v2d_device_t *dev = ctx->dev;
 	unsigned marker = get_registry(dev, VINTAGE2D_COUNTER) == 0 ? 1 : 0;
+	u64 end = ktime_get_ns() + (u64) watchdog_ms * NSEC_PER_MSEC;
+
+	if (send_encoded_cmd(dev, VINTAGE2D_CMD_COUNTER(marker, 1)))
+		return -EIO;
+	while (!counter_reached(dev, marker) && !READ_ONCE(dev->error)
+			&& !device_removed(dev)
+			&& (!watchdog_ms || ktime_get_ns() < end)) {
+		sample_tlb(ctx);
+		cpu_relax();
+	}
+	sample_tlb(ctx);
+	return wait_device(dev, counter_reached, marker);
+}
+
+static int
+send_blit(v2d_context_t *ctx, unsigned src_x, unsigned src_y, unsigned dst_x,
+		unsigned dst_y, unsigned width, unsigned height)
+{
+	if (send_cmd(ctx->dev, V2D_CMD_SRC_POS(src_x, src_y))
+			|| send_cmd(ctx->dev, V2D_CMD_DST_POS(dst_x, dst_y))
+			|| send_cmd(ctx->dev, V2D_CMD_DO_BLIT(width, height)))
+		return -EIO;
+	ctx->tlb_stats.estimated_misses += v2d_tlb_blit_misses(ctx->width,
+			src_x, src_y, dst_x, dst_y, width, height);
+	return 0;
+}
+
+static int
+send_draw(v2d_context_t *ctx, v2d_cmd_t cmd)
+{
+	v2d_device_t *dev = ctx->dev;
+	v2d_cmd_t src = last_cmd(ctx, V2D_CMD_TYPE_SRC_POS),
+		  dst = last_cmd(ctx, V2D_CMD_TYPE_DST_POS);
+	v2d_tlb_band_t bands[V2D_TLB_MAX_BANDS];
+	int i, count = 0;
+
+	++ctx->tlb_stats.draws;
+	if (V2D_CMD_TYPE(cmd) == V2D_CMD_TYPE_DO_BLIT && tlb_split)
+		count = v2d_tlb_split_blit(ctx->width,
+				V2D_CMD_POS_X(src), V2D_CMD_POS_Y(src),
+				V2D_CMD_POS_X(dst), V2D_CMD_POS_Y(dst),
+				V2D_CMD_WIDTH(cmd), V2D_CMD_HEIGHT(cmd), bands);
+	if (count == 0) {
+		if (send_cmd(dev, V2D_CMD_TYPE(cmd) == V2D_CMD_TYPE_DO_BLIT
+					? src
+					: last_cmd(ctx, V2D_CMD_TYPE_FILL_COLOR))
+				|| send_cmd(dev, dst) || send_cmd(dev, cmd))
+			return -EIO;
+		ctx->tlb_stats.estimated_misses +=
+			V2D_CMD_TYPE(cmd) == V2D_CMD_TYPE_DO_BLIT
+			? v2d_tlb_blit_misses(ctx->width,
+				V2D_CMD_POS_X(src), V2D_CMD_POS_Y(src),
+				V2D_CMD_POS_X(dst), V2D_CMD_POS_Y(dst),
+				V2D_CMD_WIDTH(cmd), V2D_CMD_HEIGHT(cmd))
+			: v2d_tlb_fill_misses(ctx->width,
+				V2D_CMD_POS_X(dst), V2D_CMD_POS_Y(dst),
+				V2D_CMD_WIDTH(cmd), V2D_CMD_HEIGHT(cmd));
+	} else {
+		++ctx->tlb_stats.split_draws;
+		for (i = 0; i < count; ++i)
+			if (send_blit(ctx, bands[i].src_x, bands[i].src_y,
+					bands[i].dst_x, bands[i].dst_y,
+					bands[i].width, bands[i].height))
+				return -EIO;
+	}
+	if (tlb_poll)
+		return poll_tlb(ctx);
+	sample_tlb(ctx);
+	return 0;
+}
+
+/* Fails with -EIO if the device had to be recovered, see device_recover, and
+ * with -ENODEV once it is removed, when it is quiesced. */
+static int
+sync_device(v2d_device_t *dev)
+{
+	unsigned marker;
+	u64 start = ktime_get_ns(), ns;
+	int ret;
 
-	send_encoded_cmd(dev, VINTAGE2D_CMD_COUNTER(marker, 1));
-	wait_event(dev->queue, get_registry(dev, VINTAGE2D_COUNTER) == marker);
+	if (device_removed(dev)) {
+		device_quiesce(dev);
+		return -ENODEV;
+	}
+	marker = get_registry(dev, VINTAGE2D_COUNTER) == 0 ? 1 : 0;
+	trace_v2d_sync_start(dev->minor, marker);
+	ret = send_encoded_cmd(dev, VINTAGE2D_CMD_COUNTER(marker, 1));
+	if (!ret)
+		ret = wait_device(dev, counter_reached, marker);
+	ns = ktime_get_ns() - start;
+	trace_v2d_sync_end(dev->minor, ns);
+	if (stats) {
+		v2d_stats_sync(&dev->stats, ns);
+		if (dev->ctx)
+			v2d_stats_sync(&dev->ctx->stats, ns);
+	}
+	if (dev->ctx)
+		dev->ctx->clear_color = -1;
 	dev->ctx = NULL;
+	return ret;
+}
+
+/* The fill queued on creation of the canvas is the only work the CPU waits
+ * for on its own. A pending fill keeps the context on the device, so
+ * synchronizing completes it, or abandons it if the device is removed. */
+static void
+wait_clear(v2d_context_t *ctx)
+{
+	v2d_device_t *dev = ctx->dev;
+
+	if (READ_ONCE(ctx->clear_color) < 0)
+		return;
+	mutex_lock(&dev->mutex);
+	if (ctx->clear_color >= 0)
+		sync_device(dev);
+	if (ctx->clear_color >= 0)
+		abandon_clear(ctx);
+	mutex_unlock(&dev->mutex);
+}
+
+static int
+prepare_draw(v2d_context_t *ctx, unsigned x, unsigned y, unsigned width,
+		unsigned height)
+{
+	v2d_device_t *dev = ctx->dev;
+
+	if (v2d_context_rect_shared(ctx, x, y, width, height)) {
+		if (dev->ctx == ctx)
+			sync_device(dev);
+		if (v2d_context_unshare_rect(ctx, x, y, width, height))
+			return -ENOMEM;
+	}
+	v2d_context_damage(ctx, x, y, width, height);
+	return 0;
+}
+
+static void
+capture_cmd(v2d_context_t *ctx, v2d_cmd_t cmd)
+{
+	if (ctx->capture)
+		v2d_capture_record(ctx, ktime_get_ns(), V2D_CAPTURE_CMD, cmd,
+				NULL, 0);
+}
+
+/* Follows the commands accepted by the write, so that a replay can issue
+ * them in the same batches. */
+static void
+capture_write(v2d_context_t *ctx, size_t count, u64 ns)
+{
+	if (!READ_ONCE(ctx->capture))
+		return;
+	mutex_lock(&ctx->mutex);
+	v2d_capture_record(ctx, ns, V2D_CAPTURE_WRITE, count, NULL, 0);
+	mutex_unlock(&ctx->mutex);
+}
+
+/* Records the copy of the argument that the handler acted on. */
+static void
+capture_ioctl(v2d_context_t *ctx, unsigned int cmd, const void *arg, u64 ns)
+{
+	size_t size = 0;
+
+	if (!READ_ONCE(ctx->capture))
+		return;
+	if (_IOC_DIR(cmd) & _IOC_WRITE)
+		size = _IOC_SIZE(cmd);
+	mutex_lock(&ctx->mutex);
+	v2d_capture_record(ctx, ns, V2D_CAPTURE_IOCTL, cmd, arg, size);
+	mutex_unlock(&ctx->mutex);
 }
 
 static irqreturn_t
@@ -228,6 +580,7 @@ irq_handler(int irq, void *dev)
 {
 	v2d_device_t *v2d_dev = dev;
 	unsigned intr = get_registry(dev, VINTAGE2D_INTR);
+	int i;
 
 	if (!(get_registry(dev, VINTAGE2D_INTR) && (VINTAGE2D_INTR_NOTIFY
 			| VINTAGE2D_INTR_INVALID_CMD
@@ -236,7 +589,19 @@ irq_handler(int irq, void *dev)
 			| VINTAGE2D_INTR_FIFO_OVERFLOW)))
 		return IRQ_NONE;
 
+	/* Waiters recover the device, see wait_device. */
+	if (intr & (VINTAGE2D_INTR_INVALID_CMD | VINTAGE2D_INTR_PAGE_FAULT
+			| VINTAGE2D_INTR_CANVAS_OVERFLOW
+			| VINTAGE2D_INTR_FIFO_OVERFLOW))
+		WRITE_ONCE(v2d_dev->error, v2d_dev->error | intr);
 	wake_up(&v2d_dev->queue);
+	trace_v2d_irq(v2d_dev->minor, intr);
+	if (stats) {
+		++v2d_dev->stats.irqs;
+		for (i = 0; i < V2D_STATS_ERRORS; ++i)
+			if (intr & VINTAGE2D_INTR_INVALID_CMD << i)
+				++v2d_dev->stats.errors[i];
+	}
 	if (intr & VINTAGE2D_INTR_INVALID_CMD)
 		printk(KERN_ERR "v2d: irq invalid command\n");
 	if (intr & VINTAGE2D_INTR_PAGE_FAULT)
@@ -254,16 +619,83 @@ irq_handler(int irq, void *dev)
 }
 
 /* vm ************************************************************************/
+/* Canvas pages are DMA memory outside any page cache, so they are inserted by
+ * pfn. The pte is installed under the context mutex, so that a page replaced
+ * and unmapped under the mutex is never mapped again. Since the vma has
+ * pfn_mkwrite, ptes start read-only and the first write goes through it. */
 static int
 v2d_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 {
 	pgoff_t pgoff = vmf->pgoff;
 	struct page *page;
 	v2d_context_t *ctx = vma->vm_private_data;
+	int ret;
+
+	wait_clear(ctx);
+	mutex_lock(&ctx->mutex);
+	if (pgoff >= ctx->canvas_pages_count) {
+		mutex_unlock(&ctx->mutex);
+		return VM_FAULT_SIGBUS;
+	}
+	page = dma_addr_mapping_page(&ctx->canvas_pages[pgoff]);
+	ret = vm_insert_mixed(vma, (unsigned long) vmf->virtual_address,
+			__pfn_to_pfn_t(page_to_pfn(page), PFN_DEV));
+	mutex_unlock(&ctx->mutex);
+	if (ret == -ENOMEM)
+		return VM_FAULT_OOM;
+	/* -EBUSY: another thread mapped the page first. */
+	if (ret && ret != -EBUSY)
+		return VM_FAULT_SIGBUS;
+	return VM_FAULT_NOPAGE;
+}
+
+/* Writes to pages shared with a snapshot copy the page first. Unsharing
+ * unmaps the page, so the access faults again on the copy. */
+static int
+v2d_vm_pfn_mkwrite(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	pgoff_t pgoff = vmf->pgoff;
+	v2d_context_t *ctx = vma->vm_private_data;
+	v2d_device_t *dev = ctx->dev;
+	int ret = 0;
+
+	mutex_lock(&ctx->mutex);
+	if (!ctx->shared || pgoff >= ctx->canvas_pages_count
+			|| !test_bit(pgoff, ctx->shared)) {
+		mutex_unlock(&ctx->mutex);
+		return 0;
+	}
+	mutex_unlock(&ctx->mutex);
 
-	if (pgoff >= ctx->canvas_pages_count)
+	mutex_lock(&dev->mutex);
+	mutex_lock(&ctx->mutex);
+	if (ctx->shared && pgoff < ctx->canvas_pages_count
+			&& test_bit(pgoff, ctx->shared)) {
+		if (dev->ctx == ctx)
+			sync_device(dev);
+		if (v2d_context_unshare_page(ctx, pgoff))
+			ret = VM_FAULT_OOM;
+	}
+	mutex_unlock(&ctx->mutex);
+	mutex_unlock(&dev->mutex);
+	return ret;
+}
+
+static struct vm_operations_struct v2d_vm_ops = {
+	.fault = v2d_vm_fault,
+	.pfn_mkwrite = v2d_vm_pfn_mkwrite
+};
+
+static int
+v2d_snapshot_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	pgoff_t pgoff = vmf->pgoff;
+	struct page *page;
+	v2d_snapshot_t *snap = vma->vm_private_data;
+
+	if (pgoff >= snap->canvas_pages_count)
 		return VM_FAULT_SIGBUS;
-	page = pfn_to_page(__pa(ctx->canvas_pages[pgoff].addr) >> PAGE_SHIFT);
+	page = dma_addr_mapping_page(&snap->canvas_pages[pgoff]);
 	if (!page)
 		return VM_FAULT_SIGBUS;
 	get_page(page);
@@ -271,154 +703,974 @@ v2d_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return 0;
 }
 
-static struct vm_operations_struct v2d_vm_ops = {
-	.fault = v2d_vm_fault
+static struct vm_operations_struct v2d_snapshot_vm_ops = {
+	.fault = v2d_snapshot_vm_fault
 };
 
-/* file **********************************************************************/
+/* snapshot ******************************************************************/
 static int
-v2d_open(struct inode *inode, struct file *file)
+v2d_snapshot_release(struct inode *inode, struct file *file)
 {
-	v2d_device_t *dev = v2d_devices_by_minor(
-		devices,
-		max_devices,
-		iminor(inode));
-	v2d_context_t *ctx = kmalloc(sizeof(v2d_context_t), GFP_KERNEL);
-	if (!ctx)
-		return -ENOMEM;
+	v2d_snapshot_t *snap = file->private_data;
+	v2d_context_t *ctx = snap->ctx;
+	struct file *ctx_file = ctx->file;
 
-	mutex_init(&ctx->mutex);
-	ctx->dev = dev;
-	ctx->canvas_pages_count = 0;
+	mutex_lock(&ctx->mutex);
+	v2d_snapshot_finalize(snap);
+	mutex_unlock(&ctx->mutex);
+	kfree(snap);
+	fput(ctx_file);
+	return 0;
+}
 
-	file->private_data = (void*) ctx;
+static int
+v2d_snapshot_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_private_data = file->private_data;
+	vma->vm_ops = &v2d_snapshot_vm_ops;
 	return 0;
 }
 
+static struct file_operations v2d_snapshot_file_ops = {
+	.owner		= THIS_MODULE,
+	.release	= v2d_snapshot_release,
+	.mmap		= v2d_snapshot_mmap
+};
+
+/* canvas ********************************************************************/
 static int
-v2d_release(struct inode *inode, struct file *file)
+v2d_canvas_release(struct inode *inode, struct file *file)
 {
 	v2d_context_t *ctx = file->private_data;
-	v2d_device_t *dev = ctx->dev;
 
-	mutex_lock(&dev->mutex);
-	mutex_lock(&ctx->mutex);
-	if (dev->ctx == ctx)
-		sync_device(dev);
-	v2d_context_finalize(ctx);
-	ctx->canvas_pages_count = -1;
-	mutex_unlock(&ctx->mutex);
-	mutex_unlock(&dev->mutex);
-	kfree(ctx);
+	fput(ctx->file);
 	return 0;
 }
 
-static long
-v2d_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+static loff_t
+v2d_canvas_llseek(struct file *file, loff_t offset, int whence)
 {
 	v2d_context_t *ctx = file->private_data;
-	struct v2d_ioctl_set_dimensions dim;
-	long ret;
+	loff_t size;
 
-	if (cmd != V2D_IOCTL_SET_DIMENSIONS)
-		return -ENOTTY;
-	if (copy_from_user((void*) &dim, (void*) arg,
-			sizeof(struct v2d_ioctl_set_dimensions)))
-		return -EFAULT;
 	mutex_lock(&ctx->mutex);
-	if (ctx->canvas_pages_count != 0
-			|| MIN_CANVAS_SIZE > dim.width
-			|| MIN_CANVAS_SIZE > dim.height
-			|| MAX_CANVAS_SIZE < dim.width
-			|| MAX_CANVAS_SIZE < dim.height) {
-		mutex_unlock(&ctx->mutex);
-		return -EINVAL;
-	}
-	ret = v2d_context_initialize(ctx, dim.width, dim.height);
+	size = ctx->canvas_pages_count > 0 ? ctx->width * ctx->height : 0;
 	mutex_unlock(&ctx->mutex);
-	return ret;
+	return fixed_size_llseek(file, offset, whence, size);
 }
 
+/* Called with the device and the context locked. Shortens len to the end of
+ * the canvas. Pending commands of the context are completed first. */
 static int
-v2d_mmap(struct file *file, struct vm_area_struct *vma)
+canvas_chunk(v2d_context_t *ctx, loff_t pos, uint8_t *buf, size_t *len,
+		bool write)
 {
-	v2d_context_t *ctx = file->private_data;
+	v2d_device_t *dev = ctx->dev;
+	loff_t size = ctx->canvas_pages_count > 0
+		? ctx->width * ctx->height : 0;
 
-	mutex_lock(&ctx->mutex);
-	if (ctx->canvas_pages_count <= 0) {
-		mutex_unlock(&ctx->mutex);
-		return -EINVAL;
+	if (device_removed(dev))
+		return -ENODEV;
+	if (pos >= size) {
+		*len = 0;
+		return write ? -ENOSPC : 0;
 	}
-	vma->vm_private_data = file->private_data;
-	vma->vm_ops = &v2d_vm_ops;
-	mutex_unlock(&ctx->mutex);
+	*len = min_t(loff_t, *len, size - pos);
+	if (dev->ctx == ctx)
+		sync_device(dev);
+	if (write && ctx->shared
+			&& v2d_context_unshare_range(ctx, pos, *len))
+		return -ENOMEM;
+	v2d_context_access(ctx, pos, buf, *len, write);
 	return 0;
 }
 
+/* Pixels go through a buffer, V2D_STREAM_CHUNK bytes at a time, because the
+ * user memory may be a mapping of a canvas, whose faults take the locks. */
 static ssize_t
-v2d_write(struct file *file, const char *buffer, size_t len, loff_t *off)
+canvas_rw(struct kiocb *iocb, struct iov_iter *iter, bool write)
 {
-	v2d_cmd_t cmd;
-	v2d_context_t *ctx = (v2d_context_t *) file->private_data;
+	v2d_context_t *ctx = iocb->ki_filp->private_data;
 	v2d_device_t *dev = ctx->dev;
+	size_t len = iov_iter_count(iter), done = 0, chunk, copied;
+	loff_t pos = iocb->ki_pos;
+	uint8_t *buf;
+	int ret = 0;
 
-	if (len % 4)
-		return -1;
-	if (copy_from_user(&cmd, buffer, 4))
-		return -EFAULT;
-	switch (V2D_CMD_TYPE(cmd)) {
-	case V2D_CMD_TYPE_SRC_POS:
-	case V2D_CMD_TYPE_DST_POS:
-	case V2D_CMD_TYPE_FILL_COLOR:
-		mutex_lock(&ctx->mutex);
-		if (ctx->canvas_pages_count <= 0) {
-			mutex_unlock(&ctx->mutex);
-			return -EINVAL;
-		}
-		if (!validate_cmd(ctx, cmd)) {
-			mutex_unlock(&ctx->mutex);
-			return -EINVAL;
+	if (len == 0)
+		return 0;
+	if (device_removed(dev))
+		return -ENODEV;
+	buf = kmalloc(min_t(size_t, len, V2D_STREAM_CHUNK), GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	while (done < len) {
+		chunk = min_t(size_t, len - done, V2D_STREAM_CHUNK);
+		if (write && copy_from_iter(buf, chunk, iter) != chunk) {
+			ret = -EFAULT;
+			break;
 		}
-		ctx->history[ctx->history_it] = cmd;
-		ctx->history_it = (ctx->history_it + 1) % 2;
-		mutex_unlock(&ctx->mutex);
-		break;
-	case V2D_CMD_TYPE_DO_FILL:
-	case V2D_CMD_TYPE_DO_BLIT:
 		mutex_lock(&dev->mutex);
 		mutex_lock(&ctx->mutex);
-		if (ctx->canvas_pages_count <= 0) {
-			mutex_unlock(&ctx->mutex);
-			mutex_unlock(&dev->mutex);
-			return -EINVAL;
-		}
-		if (dev->dev == NULL) {
-			mutex_unlock(&ctx->mutex);
-			mutex_unlock(&dev->mutex);
-			return -ENODEV;
-		}
-		if (!validate_cmd(ctx, cmd)) {
-			mutex_unlock(&ctx->mutex);
-			mutex_unlock(&dev->mutex);
-			return -EINVAL;
-		}
-		if (dev->ctx != ctx) {
-			if (dev->ctx != NULL)
-				sync_device(dev);
-			set_context(ctx);
-		}
-		send_cmd(dev, ctx->history[0]);
-		send_cmd(dev, ctx->history[1]);
-		send_cmd(dev, cmd);
-		ctx->history[ctx->history_it] = cmd;
-		ctx->history_it = (ctx->history_it + 1) % 2;
+		ret = canvas_chunk(ctx, pos, buf, &chunk, write);
 		mutex_unlock(&ctx->mutex);
 		mutex_unlock(&dev->mutex);
-		break;
-	default:
-		return -EINVAL;
+		if (ret || chunk == 0)
+			break;
+		/* The pipe of a splice takes only what fits in it, so a short
+		 * copy ends the read at what was copied. */
+		copied = write ? chunk : copy_to_iter(buf, chunk, iter);
+		pos += copied;
+		done += copied;
+		if (copied != chunk) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+	kfree(buf);
+	iocb->ki_pos = pos;
+	return done ? done : ret;
+}
+
+static ssize_t
+v2d_canvas_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	return canvas_rw(iocb, to, false);
+}
+
+static ssize_t
+v2d_canvas_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	return canvas_rw(iocb, from, true);
+}
+
+static struct file_operations v2d_canvas_file_ops = {
+	.owner		= THIS_MODULE,
+	.release	= v2d_canvas_release,
+	.llseek		= v2d_canvas_llseek,
+	.read_iter	= v2d_canvas_read_iter,
+	.write_iter	= v2d_canvas_write_iter,
+	.splice_read	= generic_file_splice_read,
+	.splice_write	= iter_file_splice_write
+};
+
+/* file **********************************************************************/
+static int
+v2d_open(struct inode *inode, struct file *file)
+{
+	v2d_device_t *dev = v2d_devices_get(&devices, iminor(inode));
+	v2d_context_t *ctx;
+	char name[24];
+	int id;
+
+	if (!dev)
+		return -ENODEV;
+	ctx = kmalloc(sizeof(v2d_context_t), GFP_KERNEL);
+	if (!ctx) {
+		v2d_devices_put(&devices, dev);
+		return -ENOMEM;
+	}
+
+	mutex_init(&ctx->mutex);
+	ctx->dev = dev;
+	ctx->file = file;
+	ctx->canvas_pages_count = 0;
+	ctx->error = 0;
+	ctx->clear_color = -1;
+	ctx->node = NUMA_NO_NODE;
+	ctx->snapshot = NULL;
+	ctx->shared = NULL;
+	memset(&ctx->tlb_stats, 0, sizeof(ctx->tlb_stats));
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+	ctx->capture = NULL;
+	if (capture)
+		v2d_capture_initialize(ctx, capture);
+	id = atomic_inc_return(&contexts);
+	snprintf(name, sizeof(name), "ctx%d", id);
+	ctx->debugfs = debugfs_create_file(name, 0444, dev->debugfs,
+			&ctx->stats, &v2d_stats_fops);
+	snprintf(name, sizeof(name), "ctx%d_capture", id);
+	ctx->capture_debugfs = debugfs_create_file(name, 0444, dev->debugfs,
+			ctx, &v2d_capture_fops);
+
+	file->private_data = (void*) ctx;
+	return 0;
+}
+
+static int
+v2d_release(struct inode *inode, struct file *file)
+{
+	v2d_context_t *ctx = file->private_data;
+	v2d_device_t *dev = ctx->dev;
+
+	debugfs_remove(ctx->debugfs);
+	debugfs_remove(ctx->capture_debugfs);
+	mutex_lock(&dev->mutex);
+	mutex_lock(&ctx->mutex);
+	if (dev->ctx == ctx)
+		sync_device(dev);
+	v2d_context_finalize(ctx);
+	v2d_capture_finalize(ctx);
+	ctx->canvas_pages_count = -1;
+	mutex_unlock(&ctx->mutex);
+	mutex_unlock(&dev->mutex);
+	kfree(ctx);
+	v2d_devices_put(&devices, dev);
+	return 0;
+}
+
+static struct file_operations v2d_file_ops;
+
+static void
+lock_contexts(v2d_context_t *a, v2d_context_t *b)
+{
+	if (a > b)
+		swap(a, b);
+	mutex_lock(&a->mutex);
+	mutex_lock_nested(&b->mutex, SINGLE_DEPTH_NESTING);
+}
+
+static void
+unlock_contexts(v2d_context_t *a, v2d_context_t *b)
+{
+	mutex_unlock(&a->mutex);
+	mutex_unlock(&b->mutex);
+}
+
+static bool
+validate_blit_from(v2d_context_t *ctx, v2d_context_t *src,
+		struct v2d_ioctl_blit_from *blit)
+{
+	return ctx->canvas_pages_count > 0 && src->canvas_pages_count > 0
+		&& blit->width > 0 && blit->height > 0
+		&& blit->dst_x + blit->width <= ctx->width
+		&& blit->dst_y + blit->height <= ctx->height
+		&& blit->src_x + blit->width <= src->width
+		&& blit->src_y + blit->height <= src->height;
+}
+
+/* Copies the rows of the blit from done on, a band of V2D_COMBINED_ROWS at a
+ * time. Each row goes in up to three pieces, split where either end crosses a
+ * row of the combined canvas. */
+static long
+blit_rows(v2d_context_t *ctx, v2d_context_t *src,
+		struct v2d_ioctl_blit_from *blit, unsigned done)
+{
+	v2d_device_t *dev = ctx->dev;
+	dma_addr_mapping_t page_table;
+	size_t dst_offset, src_offset;
+	unsigned rows, i, left, piece, dst_addr, src_addr,
+		 width = V2D_COMBINED_ROWS_WIDTH;
+	int ret;
+
+	for (; done < blit->height; done += rows) {
+		rows = min_t(unsigned, blit->height - done, V2D_COMBINED_ROWS);
+		dst_offset = (size_t) (blit->dst_y + done) * ctx->width
+			+ blit->dst_x;
+		src_offset = (size_t) (blit->src_y + done) * src->width
+			+ blit->src_x;
+		if (prepare_draw(ctx, blit->dst_x, blit->dst_y + done,
+					blit->width, rows))
+			return -ENOMEM;
+		if (v2d_context_combine_rows(&page_table, ctx, dst_offset,
+					src, src_offset, blit->width, rows))
+			return -ENOMEM;
+		dev->ctx = ctx;
+		ret = set_canvas(dev, page_table.dma_handle, width, 8 * rows);
+		for (i = 0; i < rows && !ret; ++i) {
+			dst_addr = 4 * i * VINTAGE2D_PAGE_SIZE + (dst_offset
+					+ i * ctx->width) % VINTAGE2D_PAGE_SIZE;
+			src_addr = (4 * i + 2) * VINTAGE2D_PAGE_SIZE
+				+ (src_offset + i * src->width)
+				% VINTAGE2D_PAGE_SIZE;
+			for (left = blit->width; left > 0 && !ret;
+					left -= piece) {
+				piece = min(left, min(width - dst_addr % width,
+							width - src_addr % width));
+				ret = send_encoded_cmd(dev, VINTAGE2D_CMD_SRC_POS(
+						src_addr % width,
+						src_addr / width, 1));
+				if (!ret)
+					ret = send_encoded_cmd(dev,
+						VINTAGE2D_CMD_DST_POS(
+							dst_addr % width,
+							dst_addr / width, 1));
+				if (!ret)
+					ret = send_encoded_cmd(dev,
+						VINTAGE2D_CMD_DO_BLIT(piece, 1,
+							1));
+				dst_addr += piece;
+				src_addr += piece;
+			}
+		}
+		if (!ret)
+			ret = sync_device(dev);
+		dma_addr_mapping_finalize(&page_table, dev);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/* Both canvases are mapped into a temporary page table, a band of rows at a
+ * time. The device is synchronized before the first band, so that pending
+ * commands of either context are complete, and after each band, so that the
+ * temporary page table can be rewritten and finally freed. Canvases of
+ * different widths, and widths that leave no band of even one row, go
+ * through blit_rows. */
+static long
+blit_between(v2d_context_t *ctx, v2d_context_t *src,
+		struct v2d_ioctl_blit_from *blit)
+{
+	v2d_device_t *dev = ctx->dev;
+	dma_addr_mapping_t page_table;
+	unsigned done, rows, dst_row, src_row;
+	int ret;
+
+	if (dev->ctx != NULL && sync_device(dev) == -ENODEV)
+		return -ENODEV;
+	if (ctx->width != src->width)
+		return blit_rows(ctx, src, blit, 0);
+	for (done = 0; done < blit->height; done += rows) {
+		rows = blit->height - done;
+		while (rows > 0 && v2d_context_combined_height(ctx->width,
+					blit->dst_y + done, blit->src_y + done,
+					rows) > MAX_CANVAS_SIZE)
+			rows /= 2;
+		if (rows == 0)
+			return blit_rows(ctx, src, blit, done);
+		if (prepare_draw(ctx, blit->dst_x, blit->dst_y + done,
+					blit->width, rows))
+			return -ENOMEM;
+		if (v2d_context_combine(&page_table, ctx, blit->dst_y + done,
+					src, blit->src_y + done, rows,
+					&dst_row, &src_row))
+			return -ENOMEM;
+		/* The band is accounted to the context, until the following
+		 * sync. */
+		dev->ctx = ctx;
+		ret = set_canvas(dev, page_table.dma_handle, ctx->width,
+				src_row + rows);
+		if (!ret)
+			ret = send_encoded_cmd(dev, VINTAGE2D_CMD_SRC_POS(
+					blit->src_x, src_row, 1));
+		if (!ret)
+			ret = send_encoded_cmd(dev, VINTAGE2D_CMD_DST_POS(
+					blit->dst_x, dst_row, 1));
+		if (!ret)
+			ret = send_encoded_cmd(dev, VINTAGE2D_CMD_DO_BLIT(
+					blit->width, rows, 1));
+		if (!ret)
+			ret = sync_device(dev);
+		dma_addr_mapping_finalize(&page_table, dev);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static long
+v2d_ioctl_blit_from(v2d_context_t *ctx, struct v2d_ioctl_blit_from *blit)
+{
+	v2d_device_t *dev = ctx->dev;
+	struct fd src_file;
+	v2d_context_t *src;
+	long ret;
+
+	src_file = fdget(blit->src_fd);
+	if (!src_file.file)
+		return -EBADF;
+	src = src_file.file->private_data;
+	if (src_file.file->f_op != &v2d_file_ops || src == ctx
+			|| src->dev != dev) {
+		ret = -EINVAL;
+		goto outfd;
+	}
+	mutex_lock(&dev->mutex);
+	lock_contexts(ctx, src);
+	if (device_removed(dev))
+		ret = -ENODEV;
+	else if (!validate_blit_from(ctx, src, blit))
+		ret = -EINVAL;
+	else
+		ret = blit_between(ctx, src, blit);
+	unlock_contexts(ctx, src);
+	mutex_unlock(&dev->mutex);
+outfd:
+	fdput(src_file);
+	return ret;
+}
+
+/* Called with the device and the context locked. */
+static long
+resize_locked(v2d_context_t *ctx, uint16_t width, uint16_t height,
+		uint32_t flags)
+{
+	v2d_device_t *dev = ctx->dev;
+
+	if (device_removed(dev))
+		return -ENODEV;
+	if (ctx->canvas_pages_count <= 0)
+		return -EINVAL;
+	if (ctx->snapshot)
+		return -EBUSY;
+	if (dev->ctx == ctx)
+		sync_device(dev);
+	return v2d_context_resize(ctx, width, height,
+			flags & V2D_RESIZE_PRESERVE);
+}
+
+static long
+resize_canvas(v2d_context_t *ctx, uint16_t width, uint16_t height,
+		uint32_t flags)
+{
+	v2d_device_t *dev = ctx->dev;
+	long ret;
+
+	mutex_lock(&dev->mutex);
+	mutex_lock(&ctx->mutex);
+	ret = resize_locked(ctx, width, height, flags);
+	mutex_unlock(&ctx->mutex);
+	mutex_unlock(&dev->mutex);
+	return ret;
+}
+
+static long
+v2d_ioctl_set_dimensions(v2d_context_t *ctx,
+		struct v2d_ioctl_set_dimensions *dim)
+{
+	long ret;
+
+	if (MIN_CANVAS_SIZE > dim->width
+			|| MIN_CANVAS_SIZE > dim->height
+			|| MAX_CANVAS_SIZE < dim->width
+			|| MAX_CANVAS_SIZE < dim->height)
+		return -EINVAL;
+	mutex_lock(&ctx->mutex);
+	if (ctx->canvas_pages_count == 0) {
+		ret = v2d_context_initialize(ctx, dim->width, dim->height,
+				true);
+		mutex_unlock(&ctx->mutex);
+		return ret;
+	}
+	mutex_unlock(&ctx->mutex);
+	/* An existing canvas is resized and cleared. */
+	return resize_canvas(ctx, dim->width, dim->height, 0);
+}
+
+/* If the device fails, the fill is done by the CPU instead, so that only it
+ * is lost and the context need not be told. */
+static void
+send_clear(v2d_context_t *ctx, uint8_t color)
+{
+	v2d_device_t *dev = ctx->dev;
+
+	v2d_context_clear_tail(ctx);
+	v2d_context_damage(ctx, 0, 0, ctx->width, ctx->height);
+	if (dev->ctx != ctx) {
+		if (dev->ctx != NULL)
+			sync_device(dev);
+		if (set_context(ctx))
+			goto outcpu;
+	}
+	if (send_encoded_cmd(dev, VINTAGE2D_CMD_FILL_COLOR(color, 1))
+			|| send_encoded_cmd(dev, VINTAGE2D_CMD_DST_POS(0, 0, 1))
+			|| send_encoded_cmd(dev, VINTAGE2D_CMD_DO_FILL(
+					ctx->width, ctx->height, 1)))
+		goto outcpu;
+	ctx->clear_color = color;
+	return;
+outcpu:
+	v2d_context_fill(ctx, color);
+	ctx->error = 0;
+}
+
+static long
+v2d_ioctl_set_dimensions_fill(v2d_context_t *ctx,
+		struct v2d_ioctl_set_dimensions_fill *dim)
+{
+	v2d_device_t *dev = ctx->dev;
+	long ret;
+
+	if (MIN_CANVAS_SIZE > dim->width
+			|| MIN_CANVAS_SIZE > dim->height
+			|| MAX_CANVAS_SIZE < dim->width
+			|| MAX_CANVAS_SIZE < dim->height
+			|| dim->pad[0] || dim->pad[1] || dim->pad[2])
+		return -EINVAL;
+	mutex_lock(&dev->mutex);
+	mutex_lock(&ctx->mutex);
+	if (device_removed(dev))
+		ret = -ENODEV;
+	else if (ctx->canvas_pages_count == 0)
+		ret = v2d_context_initialize(ctx, dim->width, dim->height,
+				false);
+	else
+		ret = resize_locked(ctx, dim->width, dim->height, 0);
+	if (!ret)
+		send_clear(ctx, dim->color);
+	mutex_unlock(&ctx->mutex);
+	mutex_unlock(&dev->mutex);
+	return ret;
+}
+
+static long
+v2d_ioctl_resize(v2d_context_t *ctx, struct v2d_ioctl_resize *resize)
+{
+	if (MIN_CANVAS_SIZE > resize->width
+			|| MIN_CANVAS_SIZE > resize->height
+			|| MAX_CANVAS_SIZE < resize->width
+			|| MAX_CANVAS_SIZE < resize->height
+			|| resize->flags & ~V2D_RESIZE_PRESERVE)
+		return -EINVAL;
+	return resize_canvas(ctx, resize->width, resize->height, resize->flags);
+}
+
+static long
+v2d_ioctl_fsync_damage(v2d_context_t *ctx, unsigned long arg)
+{
+	v2d_device_t *dev = ctx->dev;
+	struct v2d_ioctl_damage damage;
+	int i, ret;
+
+	mutex_lock(&dev->mutex);
+	mutex_lock(&ctx->mutex);
+	if (device_removed(dev) || ctx->canvas_pages_count <= 0) {
+		mutex_unlock(&ctx->mutex);
+		mutex_unlock(&dev->mutex);
+		return device_removed(dev) ? -ENODEV : -EINVAL;
+	}
+	if (dev->ctx == ctx)
+		sync_device(dev);
+	/* Damage of lost commands is kept for the next call. */
+	if (ctx->error) {
+		ret = ctx->error;
+		ctx->error = 0;
+		mutex_unlock(&ctx->mutex);
+		mutex_unlock(&dev->mutex);
+		return ret;
+	}
+	memcpy(damage.rows, ctx->damage, sizeof(damage.rows));
+	memset(ctx->damage, 0, sizeof(ctx->damage));
+	mutex_unlock(&ctx->mutex);
+	mutex_unlock(&dev->mutex);
+
+	if (copy_to_user((void*) arg, (void*) &damage,
+			sizeof(struct v2d_ioctl_damage))) {
+		mutex_lock(&ctx->mutex);
+		for (i = 0; i < V2D_DAMAGE_TILES; ++i)
+			ctx->damage[i] |= damage.rows[i];
+		mutex_unlock(&ctx->mutex);
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/* The snapshot holds a reference to the file of its context, so the context
+ * outlives it. */
+static long
+v2d_ioctl_snapshot(v2d_context_t *ctx)
+{
+	v2d_device_t *dev = ctx->dev;
+	v2d_snapshot_t *snap;
+	long ret;
+
+	snap = kmalloc(sizeof(v2d_snapshot_t), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+	mutex_lock(&dev->mutex);
+	mutex_lock(&ctx->mutex);
+	if (ctx->canvas_pages_count <= 0 || ctx->snapshot != NULL) {
+		ret = ctx->snapshot != NULL ? -EBUSY : -EINVAL;
+		goto outsnap;
+	}
+	if (dev->ctx == ctx)
+		sync_device(dev);
+	ret = v2d_snapshot_initialize(snap, ctx);
+	if (ret)
+		goto outsnap;
+	get_file(ctx->file);
+	ret = anon_inode_getfd("v2d-snapshot", &v2d_snapshot_file_ops, snap,
+			O_RDONLY | O_CLOEXEC);
+	if (ret < 0) {
+		v2d_snapshot_finalize(snap);
+		fput(ctx->file);
+		goto outsnap;
+	}
+	mutex_unlock(&ctx->mutex);
+	mutex_unlock(&dev->mutex);
+	return ret;
+outsnap:
+	mutex_unlock(&ctx->mutex);
+	mutex_unlock(&dev->mutex);
+	kfree(snap);
+	return ret;
+}
+
+/* The descriptor holds a reference to the file of its context, as a snapshot
+ * does. Anonymous files are not seekable unless told so. */
+static long
+v2d_ioctl_canvas_fd(v2d_context_t *ctx)
+{
+	struct file *file;
+	int fd;
+
+	mutex_lock(&ctx->mutex);
+	if (ctx->canvas_pages_count <= 0) {
+		mutex_unlock(&ctx->mutex);
+		return -EINVAL;
+	}
+	mutex_unlock(&ctx->mutex);
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0)
+		return fd;
+	get_file(ctx->file);
+	file = anon_inode_getfile("v2d-canvas", &v2d_canvas_file_ops, ctx,
+			O_RDWR);
+	if (IS_ERR(file)) {
+		fput(ctx->file);
+		put_unused_fd(fd);
+		return PTR_ERR(file);
 	}
-	return 4;
+	file->f_mode |= FMODE_LSEEK | FMODE_PREAD | FMODE_PWRITE;
+	fd_install(fd, file);
+	return fd;
+}
+
+static bool
+validate_pattern_fill(v2d_context_t *ctx, struct v2d_ioctl_pattern_fill *fill)
+{
+	bool at_origin = fill->src_x == fill->dst_x
+		&& fill->src_y == fill->dst_y;
+
+	return ctx->canvas_pages_count > 0
+		&& fill->tile_width > 0 && fill->tile_height > 0
+		&& fill->width > 0 && fill->height > 0
+		&& fill->src_x + fill->tile_width <= ctx->width
+		&& fill->src_y + fill->tile_height <= ctx->height
+		&& fill->dst_x + fill->width <= ctx->width
+		&& fill->dst_y + fill->height <= ctx->height
+		&& (at_origin
+			|| fill->src_x >= fill->dst_x + fill->width
+			|| fill->dst_x >= fill->src_x + fill->tile_width
+			|| fill->src_y >= fill->dst_y + fill->height
+			|| fill->dst_y >= fill->src_y + fill->tile_height);
+}
+
+/* The tile is copied to the origin of the destination and then the filled
+ * part is doubled with each blit, first along the rows and then along the
+ * columns, so a destination of N tiles takes about 2 * log2(N) blits. */
+static int
+send_pattern_fill(v2d_context_t *ctx, struct v2d_ioctl_pattern_fill *fill)
+{
+	unsigned width = min(fill->tile_width, fill->width),
+		 height = min(fill->tile_height, fill->height),
+		 size;
+
+	++ctx->tlb_stats.draws;
+	if ((fill->src_x != fill->dst_x || fill->src_y != fill->dst_y)
+			&& send_blit(ctx, fill->src_x, fill->src_y,
+				fill->dst_x, fill->dst_y, width, height))
+		return -EIO;
+	for (; width < fill->width; width += size) {
+		size = min(width, fill->width - width);
+		if (send_blit(ctx, fill->dst_x, fill->dst_y,
+					fill->dst_x + width, fill->dst_y,
+					size, height))
+			return -EIO;
+	}
+	for (; height < fill->height; height += size) {
+		size = min(height, fill->height - height);
+		if (send_blit(ctx, fill->dst_x, fill->dst_y, fill->dst_x,
+					fill->dst_y + height, width, size))
+			return -EIO;
+	}
+	if (tlb_poll)
+		return poll_tlb(ctx);
+	sample_tlb(ctx);
+	return 0;
+}
+
+static long
+v2d_ioctl_pattern_fill(v2d_context_t *ctx, struct v2d_ioctl_pattern_fill *fill)
+{
+	v2d_device_t *dev = ctx->dev;
+	long ret = 0;
+
+	mutex_lock(&dev->mutex);
+	mutex_lock(&ctx->mutex);
+	if (device_removed(dev)) {
+		ret = -ENODEV;
+		goto out;
+	}
+	if (!validate_pattern_fill(ctx, fill)) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (prepare_draw(ctx, fill->dst_x, fill->dst_y, fill->width,
+				fill->height)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (dev->ctx != ctx) {
+		if (dev->ctx != NULL)
+			sync_device(dev);
+		ret = set_context(ctx);
+		if (ret)
+			goto out;
+	}
+	ret = send_pattern_fill(ctx, fill);
+out:
+	mutex_unlock(&ctx->mutex);
+	mutex_unlock(&dev->mutex);
+	return ret;
+}
+
+static long
+v2d_ioctl_tlb_stats(v2d_context_t *ctx, unsigned long arg)
+{
+	struct v2d_ioctl_tlb_stats stats;
+
+	mutex_lock(&ctx->mutex);
+	stats = ctx->tlb_stats;
+	mutex_unlock(&ctx->mutex);
+	if (copy_to_user((void*) arg, (void*) &stats,
+			sizeof(struct v2d_ioctl_tlb_stats)))
+		return -EFAULT;
+	return 0;
+}
+
+static long
+v2d_ioctl_capture(v2d_context_t *ctx, struct v2d_ioctl_capture *cap)
+{
+	long ret = 0;
+
+	mutex_lock(&ctx->mutex);
+	if (cap->entries == 0)
+		v2d_capture_finalize(ctx);
+	else
+		ret = v2d_capture_initialize(ctx, cap->entries);
+	mutex_unlock(&ctx->mutex);
+	return ret;
+}
+
+static long
+v2d_ioctl_set_node(v2d_context_t *ctx, struct v2d_ioctl_node *node)
+{
+	long ret = 0;
+
+	if (node->node != NUMA_NO_NODE && (node->node < 0
+				|| node->node >= nr_node_ids
+				|| !node_online(node->node)))
+		return -EINVAL;
+	mutex_lock(&ctx->mutex);
+	if (ctx->canvas_pages_count != 0)
+		ret = -EBUSY;
+	else
+		ctx->node = node->node;
+	mutex_unlock(&ctx->mutex);
+	return ret;
+}
+
+static long
+v2d_ioctl_get_node(v2d_context_t *ctx, unsigned long arg)
+{
+	struct v2d_ioctl_node node = { 0 };
+	int i;
+
+	mutex_lock(&ctx->mutex);
+	node.node = ctx->node == NUMA_NO_NODE ? ctx->dev->node : ctx->node;
+	/* A device outside any node gets pages from wherever the allocator
+	 * finds them, so the node of the first one is reported. */
+	if (node.node == NUMA_NO_NODE)
+		node.node = ctx->canvas_pages_count == 0 ? numa_node_id()
+			: page_to_nid(dma_addr_mapping_page(
+						&ctx->canvas_pages[0]));
+	for (i = 0; i < ctx->canvas_pages_count; ++i) {
+		++node.pages;
+		if (page_to_nid(dma_addr_mapping_page(&ctx->canvas_pages[i]))
+				== node.node)
+			++node.node_pages;
+	}
+	mutex_unlock(&ctx->mutex);
+	if (copy_to_user((void*) arg, (void*) &node,
+			sizeof(struct v2d_ioctl_node)))
+		return -EFAULT;
+	return 0;
+}
+
+/* Arguments of the ioctls that read one. */
+union v2d_ioctl_arg {
+	struct v2d_ioctl_set_dimensions dim;
+	struct v2d_ioctl_blit_from blit;
+	struct v2d_ioctl_pattern_fill fill;
+	struct v2d_ioctl_capture cap;
+	struct v2d_ioctl_resize resize;
+	struct v2d_ioctl_node node;
+	struct v2d_ioctl_set_dimensions_fill dim_fill;
+};
+
+static long
+v2d_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	v2d_context_t *ctx = file->private_data;
+	u64 ns = ktime_get_ns();
+	union v2d_ioctl_arg karg;
+	long ret;
+
+	/* The argument is copied once, before any lock is taken, since it may
+	 * lie in a mapping of a canvas. The capture records the same copy, so
+	 * a caller changing it during the ioctl cannot make the two differ. */
+	if (_IOC_DIR(cmd) & _IOC_WRITE) {
+		if (_IOC_SIZE(cmd) > sizeof(karg))
+			return -ENOTTY;
+		if (copy_from_user((void*) &karg, (void*) arg,
+					_IOC_SIZE(cmd)))
+			return -EFAULT;
+	}
+	switch (cmd) {
+	case V2D_IOCTL_SET_DIMENSIONS:
+		ret = v2d_ioctl_set_dimensions(ctx, &karg.dim);
+		break;
+	case V2D_IOCTL_BLIT_FROM:
+		ret = v2d_ioctl_blit_from(ctx, &karg.blit);
+		break;
+	case V2D_IOCTL_FSYNC_DAMAGE:
+		ret = v2d_ioctl_fsync_damage(ctx, arg);
+		break;
+	case V2D_IOCTL_SNAPSHOT:
+		ret = v2d_ioctl_snapshot(ctx);
+		break;
+	case V2D_IOCTL_TLB_STATS:
+		ret = v2d_ioctl_tlb_stats(ctx, arg);
+		break;
+	case V2D_IOCTL_PATTERN_FILL:
+		ret = v2d_ioctl_pattern_fill(ctx, &karg.fill);
+		break;
+	case V2D_IOCTL_RESIZE:
+		ret = v2d_ioctl_resize(ctx, &karg.resize);
+		break;
+	case V2D_IOCTL_SET_NODE:
+		ret = v2d_ioctl_set_node(ctx, &karg.node);
+		break;
+	case V2D_IOCTL_GET_NODE:
+		ret = v2d_ioctl_get_node(ctx, arg);
+		break;
+	case V2D_IOCTL_SET_DIMENSIONS_FILL:
+		ret = v2d_ioctl_set_dimensions_fill(ctx, &karg.dim_fill);
+		break;
+	case V2D_IOCTL_CANVAS_FD:
+		ret = v2d_ioctl_canvas_fd(ctx);
+		break;
+	case V2D_IOCTL_CAPTURE:
+		return v2d_ioctl_capture(ctx, &karg.cap);
+	default:
+		return -ENOTTY;
+	}
+	if (ret >= 0)
+		capture_ioctl(ctx, cmd, &karg, ns);
+	return ret;
+}
+
+static int
+v2d_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	v2d_context_t *ctx = file->private_data;
+
+	mutex_lock(&ctx->mutex);
+	if (ctx->canvas_pages_count <= 0) {
+		mutex_unlock(&ctx->mutex);
+		return -EINVAL;
+	}
+	vma->vm_flags |= VM_MIXEDMAP;
+	vma->vm_private_data = file->private_data;
+	vma->vm_ops = &v2d_vm_ops;
+	mutex_unlock(&ctx->mutex);
+	return 0;
+}
+
+/* Called with the device and the context locked, on a context with a canvas
+ * of a present device. */
+static int
+write_cmd(v2d_context_t *ctx, v2d_cmd_t cmd)
+{
+	v2d_device_t *dev = ctx->dev;
+	v2d_cmd_t dst;
+	int ret;
+
+	if (!validate_cmd(ctx, cmd))
+		return -EINVAL;
+	switch (V2D_CMD_TYPE(cmd)) {
+	case V2D_CMD_TYPE_SRC_POS:
+	case V2D_CMD_TYPE_DST_POS:
+	case V2D_CMD_TYPE_FILL_COLOR:
+		ctx->state[V2D_STATE_INDEX(V2D_CMD_TYPE(cmd))] = cmd;
+		break;
+	case V2D_CMD_TYPE_DO_FILL:
+	case V2D_CMD_TYPE_DO_BLIT:
+		dst = last_cmd(ctx, V2D_CMD_TYPE_DST_POS);
+		if (prepare_draw(ctx, V2D_CMD_POS_X(dst), V2D_CMD_POS_Y(dst),
+				V2D_CMD_WIDTH(cmd), V2D_CMD_HEIGHT(cmd)))
+			return -ENOMEM;
+		if (dev->ctx != ctx) {
+			if (dev->ctx != NULL)
+				sync_device(dev);
+			ret = set_context(ctx);
+			if (ret)
+				return ret;
+		}
+		ret = send_draw(ctx, cmd);
+		if (ret)
+			return ret;
+		break;
+	}
+	capture_cmd(ctx, cmd);
+	return 0;
+}
+
+/* Commands are copied and executed V2D_WRITE_BATCH at a time, under one lock.
+ * On an error the number of bytes of the preceding accepted commands is
+ * returned, or the error if there are none. */
+static ssize_t
+v2d_write(struct file *file, const char *buffer, size_t len, loff_t *off)
+{
+	v2d_cmd_t cmds[V2D_WRITE_BATCH];
+	v2d_context_t *ctx = (v2d_context_t *) file->private_data;
+	v2d_device_t *dev = ctx->dev;
+	size_t done = 0, count, i;
+	u64 ns = ktime_get_ns();
+	int ret = 0;
+
+	if (len % 4)
+		return -1;
+	if (device_removed(dev))
+		return -ENODEV;
+	while (done < len && !ret) {
+		count = min(len - done, sizeof(cmds)) / 4;
+		if (copy_from_user(cmds, buffer + done, count * 4)) {
+			ret = -EFAULT;
+			break;
+		}
+		mutex_lock(&dev->mutex);
+		mutex_lock(&ctx->mutex);
+		if (ctx->canvas_pages_count <= 0)
+			ret = -EINVAL;
+		else if (device_removed(dev))
+			ret = -ENODEV;
+		for (i = 0; i < count && !ret; ++i) {
+			ret = write_cmd(ctx, cmds[i]);
+			if (!ret)
+				done += 4;
+		}
+		mutex_unlock(&ctx->mutex);
+		mutex_unlock(&dev->mutex);
+	}
+	if (done)
+		capture_write(ctx, done / 4, ns);
+	return done ? done : ret;
 }
 
 static int
@@ -426,10 +1678,13 @@ v2d_fsync(struct file *file, loff_t start, loff_t end, int datasync)
 {
 	v2d_context_t *ctx = (v2d_context_t *) file->private_data;
 	v2d_device_t *dev = ctx->dev;
+	u64 ns = ktime_get_ns();
 	int ret = 0;
 
+	if (device_removed(dev))
+		return -ENODEV;
 	mutex_lock(&dev->mutex);
-	if (dev->dev == NULL) {
+	if (device_removed(dev)) {
 		ret = -ENODEV;
 		goto out;
 	}
@@ -438,8 +1693,16 @@ v2d_fsync(struct file *file, loff_t start, loff_t end, int datasync)
 		goto out;
 	}
 	sync_device(dev);
+	/* Reports commands of the context lost since its last fsync. */
+	ret = ctx->error;
+	ctx->error = 0;
 out:
 	mutex_unlock(&dev->mutex);
+	if (READ_ONCE(ctx->capture)) {
+		mutex_lock(&ctx->mutex);
+		v2d_capture_record(ctx, ns, V2D_CAPTURE_FSYNC, ret, NULL, 0);
+		mutex_unlock(&ctx->mutex);
+	}
 	return ret;
 }
 
@@ -462,12 +1725,14 @@ v2d_probe(struct pci_dev *dev, const struct pci_device_id *id)
 	struct device *device = NULL;
 	v2d_device_t *v2d_dev;
 
-	v2d_dev = v2d_devices_add(devices, max_devices, dev);
+	v2d_dev = v2d_devices_add(&devices, dev);
 	if (v2d_dev == NULL) {
 		dev_err(&(dev->dev), "v2d_devices_add");
 		goto outadd;
 	}
 	v2d_dev->ctx = NULL;
+	v2d_dev->error = 0;
+	v2d_dev->src_tlb_tag = v2d_dev->dst_tlb_tag = 0;
 	minor = v2d_dev->minor;
 
 	cdev = cdev_alloc();
@@ -510,7 +1775,14 @@ v2d_probe(struct pci_dev *dev, const struct pci_device_id *id)
 	pci_set_master(dev);
 	pci_set_dma_mask(dev, DMA_BIT_MASK(32));
 	pci_set_consistent_dma_mask(dev, DMA_BIT_MASK(32));
+	v2d_dev->node = dev_to_node(&(dev->dev));
+	memset(&v2d_dev->stats, 0, sizeof(v2d_dev->stats));
+	v2d_dev->debugfs = debugfs_create_dir(dev_name(device), debugfs);
+	debugfs_create_file("stats", 0444, v2d_dev->debugfs, &v2d_dev->stats,
+			&v2d_stats_fops);
 	device_prepare(v2d_dev);
+	pci_set_drvdata(dev, v2d_dev);
+	v2d_devices_publish(&devices, v2d_dev);
 	return 0;
 outcmds:
 	free_irq(dev->irq, v2d_dev);
@@ -525,7 +1797,7 @@ outenable:
 outdevice:
 	cdev_del(cdev);
 outcdev:
-	v2d_devices_del(devices, max_devices, dev);
+	v2d_devices_put(&devices, v2d_dev);
 outadd:
 	return -1;
 }
@@ -533,10 +1805,14 @@ outadd:
 static void
 v2d_remove(struct pci_dev *dev)
 {
-	v2d_device_t *v2d_dev = v2d_devices_by_dev(devices, max_devices, dev);
+	v2d_device_t *v2d_dev = pci_get_drvdata(dev);
 
+	/* Waiters for the device give up with -ENODEV and release the lock. */
+	WRITE_ONCE(v2d_dev->removed, true);
+	v2d_devices_del(&devices, v2d_dev);
+	wake_up_all(&v2d_dev->queue);
 	mutex_lock(&v2d_dev->mutex);
-	device_reset(v2d_dev);
+	device_quiesce(v2d_dev);
 	dma_addr_mapping_finalize(&v2d_dev->cmds, v2d_dev);
 	free_irq(dev->irq, v2d_dev);
 	pci_iounmap(dev, v2d_dev->control);
@@ -544,8 +1820,8 @@ v2d_remove(struct pci_dev *dev)
 	pci_disable_device(dev);
 	device_destroy(class, MKDEV(MAJOR(devno), v2d_dev->minor));
 	cdev_del(v2d_dev->cdev);
-	v2d_devices_del(devices, max_devices, dev);
 	mutex_unlock(&v2d_dev->mutex);
+	v2d_devices_put(&devices, v2d_dev);
 }
 
 static struct pci_driver v2d_pci_driver = {
@@ -559,18 +1835,15 @@ static struct pci_driver v2d_pci_driver = {
 static int __init
 v2d_init_module(void)
 {
-	devices = kmalloc(max_devices * sizeof(v2d_device_t),
-			GFP_KERNEL);
-	if (!devices) {
-		printk(KERN_ERR "v2d: kmalloc\n");
-		goto outalloc;
-	}
 	if (alloc_chrdev_region(&devno, 0, max_devices, "v2d") < 0) {
 		printk(KERN_ERR "v2d: alloc_chrdev_region\n");
 		goto outchrdev;
 	}
-
-	v2d_devices_init(devices, max_devices, MINOR(devno));
+	if (v2d_devices_init(&devices, max_devices, MINOR(devno))) {
+		printk(KERN_ERR "v2d: v2d_devices_init\n");
+		goto outdevices;
+	}
+	debugfs = debugfs_create_dir("v2d", NULL);
 
 	class = class_create(THIS_MODULE, "v2d");
 	if (IS_ERR(class)) {
@@ -585,10 +1858,11 @@ v2d_init_module(void)
 outregister:
 	class_destroy(class);
 outclass:
-	unregister_chrdev_region(devno, 1);
+	debugfs_remove_recursive(debugfs);
+	v2d_devices_finalize(&devices);
+outdevices:
+	unregister_chrdev_region(devno, max_devices);
 outchrdev:
-	kfree(devices);
-outalloc:
 	return -1;
 }
 
@@ -596,9 +1870,10 @@ static void
 v2d_exit_module(void)
 {
 	pci_unregister_driver(&v2d_pci_driver);
+	debugfs_remove_recursive(debugfs);
 	class_destroy(class);
+	v2d_devices_finalize(&devices);
 	unregister_chrdev_region(devno, max_devices);
-	kfree(devices);
 }
 
 module_init(v2d_init_module);
@@ -0,0 +1,162 @@
+#include "v2d_capture.h"
+
+int
+v2d_capture_initialize(v2d_context_t *ctx, unsigned entries)
+{
+	struct v2d_ioctl_set_dimensions dim;
+	v2d_capture_t *capture;
+	int i;
+
+	if (entries == 0 || entries > V2D_CAPTURE_MAX_ENTRIES)
+		return -EINVAL;
+	capture = vzalloc(sizeof(v2d_capture_t)
+			+ entries * sizeof(v2d_capture_entry_t));
+	if (!capture)
+		return -ENOMEM;
+	capture->size = entries;
+	v2d_capture_finalize(ctx);
+	ctx->capture = capture;
+
+	/* A ring started on an existing canvas opens with its dimensions and
+	 * the remembered state commands, so that it replays on its own. */
+	if (ctx->canvas_pages_count <= 0)
+		return 0;
+	dim.height = ctx->height;
+	dim.width = ctx->width;
+	v2d_capture_record(ctx, ktime_get_ns(), V2D_CAPTURE_IOCTL,
+			V2D_IOCTL_SET_DIMENSIONS, &dim, sizeof(dim));
+	for (i = 0; i < V2D_STATE_CMDS; ++i)
+		if (ctx->state[i])
+			v2d_capture_record(ctx, ktime_get_ns(),
+					V2D_CAPTURE_CMD, ctx->state[i], NULL, 0);
+	return 0;
+}
+
+void
+v2d_capture_finalize(v2d_context_t *ctx)
+{
+	vfree(ctx->capture);
+	ctx->capture = NULL;
+}
+
+/* When the ring is full, the oldest entry is overwritten and counted as
+ * dropped. */
+void
+v2d_capture_record(v2d_context_t *ctx, u64 ns, unsigned type, uint32_t code,
+		const void *args, size_t size)
+{
+	v2d_capture_t *capture = ctx->capture;
+	v2d_capture_entry_t *entry;
+
+	if (!capture)
+		return;
+	entry = &capture->entries[capture->head];
+	capture->head = (capture->head + 1) % capture->size;
+	if (capture->count < capture->size)
+		++capture->count;
+	else
+		++capture->dropped;
+	entry->ns = ns;
+	entry->type = type;
+	entry->code = code;
+	memset(entry->args, 0, sizeof(entry->args));
+	memcpy(entry->args, args, min(size, sizeof(entry->args)));
+}
+
+/* Position 0 is the header, position n > 0 the n-th oldest entry. The context
+ * is locked from start to stop. */
+static v2d_capture_entry_t *
+capture_entry(v2d_capture_t *capture, loff_t pos)
+{
+	if (!capture || pos > capture->count)
+		return NULL;
+	return &capture->entries[(capture->head + capture->size
+			- capture->count + pos - 1) % capture->size];
+}
+
+static void *
+v2d_capture_seq_start(struct seq_file *s, loff_t *pos)
+{
+	v2d_context_t *ctx = s->private;
+
+	mutex_lock(&ctx->mutex);
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	return capture_entry(ctx->capture, *pos);
+}
+
+static void *
+v2d_capture_seq_next(struct seq_file *s, void *v, loff_t *pos)
+{
+	v2d_context_t *ctx = s->private;
+
+	++*pos;
+	return capture_entry(ctx->capture, *pos);
+}
+
+static void
+v2d_capture_seq_stop(struct seq_file *s, void *v)
+{
+	v2d_context_t *ctx = s->private;
+
+	mutex_unlock(&ctx->mutex);
+}
+
+static int
+v2d_capture_seq_show(struct seq_file *s, void *v)
+{
+	v2d_context_t *ctx = s->private;
+	v2d_capture_entry_t *entry = v;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(s, "# entries %u dropped %llu\n",
+				ctx->capture ? ctx->capture->count : 0,
+				ctx->capture ? ctx->capture->dropped : 0);
+		return 0;
+	}
+	switch (entry->type) {
+	case V2D_CAPTURE_CMD:
+		seq_printf(s, "%llu cmd %08x\n", entry->ns, entry->code);
+		break;
+	case V2D_CAPTURE_IOCTL:
+		seq_printf(s, "%llu ioctl %08x %08x %08x %08x %08x\n",
+				entry->ns, entry->code, entry->args[0],
+				entry->args[1], entry->args[2],
+				entry->args[3]);
+		break;
+	case V2D_CAPTURE_FSYNC:
+		seq_printf(s, "%llu fsync %d\n", entry->ns,
+				(int) entry->code);
+		break;
+	case V2D_CAPTURE_WRITE:
+		seq_printf(s, "%llu write %u\n", entry->ns, entry->code);
+		break;
+	}
+	return 0;
+}
+
+static const struct seq_operations v2d_capture_seq_ops = {
+	.start	= v2d_capture_seq_start,
+	.next	= v2d_capture_seq_next,
+	.stop	= v2d_capture_seq_stop,
+	.show	= v2d_capture_seq_show
+};
+
+static int
+v2d_capture_open(struct inode *inode, struct file *file)
+{
+	int ret = seq_open(file, &v2d_capture_seq_ops);
+
+	if (ret)
+		return ret;
+	((struct seq_file *) file->private_data)->private = inode->i_private;
+	return 0;
+}
+
+const struct file_operations v2d_capture_fops = {
+	.owner		= THIS_MODULE,
+	.open		= v2d_capture_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release
+};
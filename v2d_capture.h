@@ -0,0 +1,23 @@
+#ifndef V2D_CAPTURE_H
+#define V2D_CAPTURE_H
+
+#include "common.h"
+
+#define V2D_CAPTURE_CMD		0
+#define V2D_CAPTURE_IOCTL	1
+#define V2D_CAPTURE_FSYNC	2
+#define V2D_CAPTURE_WRITE	3
+
+extern const struct file_operations v2d_capture_fops;
+
+int
+v2d_capture_initialize(v2d_context_t *ctx, unsigned entries);
+
+void
+v2d_capture_finalize(v2d_context_t *ctx);
+
+void
+v2d_capture_record(v2d_context_t *ctx, u64 ns, unsigned type, uint32_t code,
+		const void *args, size_t size);
+
+#endif
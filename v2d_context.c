@@ -1,15 +1,16 @@
 #include "v2d_context.h"
 
 int
-v2d_context_initialize(v2d_context_t *ctx, uint16_t width, uint16_t height)
+v2d_context_initialize(v2d_context_t *ctx, uint16_t width, uint16_t height,
+		bool zero)
 {
 	int i;
 	unsigned *page_table;
 
 	ctx->width = width;
 	ctx->height = height;
-	ctx->history[0] = ctx->history[1] = 0;
-	ctx->history_it = 0;
+	memset(ctx->state, 0, sizeof(ctx->state));
+	memset(ctx->damage, 0, sizeof(ctx->damage));
 
 	ctx->canvas_pages_count = DIV_ROUND_UP(width * height,
 			VINTAGE2D_PAGE_SIZE);
@@ -18,8 +19,8 @@ v2d_context_initialize(v2d_context_t *ctx, uint16_t width, uint16_t height)
 			GFP_KERNEL);
 
 	for (i = 0; i < ctx->canvas_pages_count; ++i) {
-		if(dma_addr_mapping_initialize(&ctx->canvas_pages[i],
-					ctx->dev))
+		if(dma_addr_mapping_initialize_node(&ctx->canvas_pages[i],
+					ctx->dev, ctx->node, zero))
 			goto outcanvas;
 	}
 	if (dma_addr_mapping_initialize(&ctx->canvas_page_table, ctx->dev))
@@ -39,6 +40,86 @@ outcanvas:
 	return -ENOMEM;
 }
 
+void
+v2d_context_damage(v2d_context_t *ctx, unsigned x, unsigned y,
+		unsigned width, unsigned height)
+{
+	unsigned first = x / V2D_DAMAGE_TILE_SIZE,
+		 last = (x + width - 1) / V2D_DAMAGE_TILE_SIZE,
+		 row = y / V2D_DAMAGE_TILE_SIZE;
+	uint32_t mask = (uint32_t) (GENMASK(last, first));
+
+	for (; row <= (y + height - 1) / V2D_DAMAGE_TILE_SIZE; ++row)
+		ctx->damage[row] |= mask;
+}
+
+bool
+v2d_context_rect_shared(v2d_context_t *ctx, unsigned x, unsigned y,
+		unsigned width, unsigned height)
+{
+	unsigned row, offset;
+
+	if (!ctx->shared)
+		return false;
+	for (row = y; row < y + height; ++row) {
+		offset = row * ctx->width + x;
+		if (test_bit(offset / VINTAGE2D_PAGE_SIZE, ctx->shared)
+				|| test_bit((offset + width - 1)
+					/ VINTAGE2D_PAGE_SIZE, ctx->shared))
+			return true;
+	}
+	return false;
+}
+
+int
+v2d_context_unshare_page(v2d_context_t *ctx, int i)
+{
+	dma_addr_mapping_t page;
+	unsigned *page_table = (unsigned *) ctx->canvas_page_table.addr;
+
+	if (dma_addr_mapping_initialize_node(&page, ctx->dev, ctx->node,
+				false))
+		return -ENOMEM;
+	memcpy(page.addr, ctx->canvas_pages[i].addr, VINTAGE2D_PAGE_SIZE);
+	ctx->canvas_pages[i] = page;
+	page_table[i] = VINTAGE2D_PTE_VALID | page.dma_handle;
+	clear_bit(i, ctx->shared);
+	unmap_mapping_range(ctx->file->f_mapping,
+			(loff_t) i * VINTAGE2D_PAGE_SIZE, VINTAGE2D_PAGE_SIZE, 1);
+	return 0;
+}
+
+int
+v2d_context_unshare_rect(v2d_context_t *ctx, unsigned x, unsigned y,
+		unsigned width, unsigned height)
+{
+	unsigned row, offset, i;
+
+	for (row = y; row < y + height; ++row) {
+		offset = row * ctx->width + x;
+		for (i = offset / VINTAGE2D_PAGE_SIZE;
+				i <= (offset + width - 1) / VINTAGE2D_PAGE_SIZE;
+				++i)
+			if (test_bit(i, ctx->shared)
+					&& v2d_context_unshare_page(ctx, i))
+				return -ENOMEM;
+	}
+	return 0;
+}
+
+int
+v2d_context_unshare_range(v2d_context_t *ctx, size_t offset, size_t len)
+{
+	size_t i;
+
+	for (i = offset / VINTAGE2D_PAGE_SIZE;
+			i <= (offset + len - 1) / VINTAGE2D_PAGE_SIZE; ++i)
+		if (test_bit(i, ctx->shared)
+				&& v2d_context_unshare_page(ctx, i))
+			return -ENOMEM;
+	return 0;
+}
+
 void
 v2d_context_finalize(v2d_context_t *ctx)
 {
@@ -55,3 +136,234 @@ v2d_context_finalize(v2d_context_t *ctx)
 	ctx->canvas_pages_count = 0;
 }
 
+void
+v2d_context_clear_tail(v2d_context_t *ctx)
+{
+	unsigned size = ctx->width * ctx->height;
+
+	memset((uint8_t *) ctx->canvas_pages[ctx->canvas_pages_count - 1].addr
+			+ (size - 1) % VINTAGE2D_PAGE_SIZE + 1, 0,
+			VINTAGE2D_PAGE_SIZE - 1 - (size - 1) % VINTAGE2D_PAGE_SIZE);
+}
+
+void
+v2d_context_fill(v2d_context_t *ctx, uint8_t color)
+{
+	unsigned size = ctx->width * ctx->height;
+	int i;
+
+	for (i = 0; i < ctx->canvas_pages_count; ++i)
+		memset(ctx->canvas_pages[i].addr, color, min_t(unsigned,
+				size - i * VINTAGE2D_PAGE_SIZE,
+				VINTAGE2D_PAGE_SIZE));
+	v2d_context_clear_tail(ctx);
+}
+
+void
+v2d_context_unmap(v2d_context_t *ctx)
+{
+	/* Faults install ptes under the context mutex, so with it held none
+	 * can map a page after the zap. */
+	unmap_mapping_range(ctx->file->f_mapping, 0, 0, 1);
+}
+
+/* Copies len bytes at offset of the canvas from (write) or to buf, or clears
+ * them if buf is NULL. */
+static void
+canvas_access(dma_addr_mapping_t *pages, size_t offset, uint8_t *buf,
+		size_t len, bool write)
+{
+	size_t chunk;
+	uint8_t *p;
+
+	while (len > 0) {
+		chunk = min(len, VINTAGE2D_PAGE_SIZE
+				- offset % VINTAGE2D_PAGE_SIZE);
+		p = (uint8_t *) pages[offset / VINTAGE2D_PAGE_SIZE].addr
+			+ offset % VINTAGE2D_PAGE_SIZE;
+		if (!buf)
+			memset(p, 0, chunk);
+		else if (write)
+			memcpy(p, buf, chunk);
+		else
+			memcpy(buf, p, chunk);
+		offset += chunk;
+		if (buf)
+			buf += chunk;
+		len -= chunk;
+	}
+}
+
+void
+v2d_context_access(v2d_context_t *ctx, size_t offset, uint8_t *buf,
+		size_t len, bool write)
+{
+	canvas_access(ctx->canvas_pages, offset, buf, len, write);
+}
+
+/* Rows move towards the end when the canvas widens and towards the start when
+ * it narrows, so they are moved in the opposite order, never overwriting a
+ * row that is still to be moved. Everything outside of the kept rectangle is
+ * cleared, up to the end of the last page. */
+static void
+relayout(dma_addr_mapping_t *pages, int count, uint16_t old_width,
+		uint16_t old_height, uint16_t width, uint16_t height,
+		uint8_t *row)
+{
+	unsigned kept_width = min(old_width, width),
+		 kept_height = min(old_height, height),
+		 i, y;
+
+	for (i = 0; old_width != width && i < kept_height; ++i) {
+		y = width > old_width ? kept_height - 1 - i : i;
+		canvas_access(pages, y * old_width, row, kept_width, false);
+		canvas_access(pages, y * width, row, kept_width, true);
+	}
+	if (width > kept_width)
+		for (y = 0; y < kept_height; ++y)
+			canvas_access(pages, y * width + kept_width, NULL,
+					width - kept_width, true);
+	canvas_access(pages, kept_height * width, NULL,
+			count * VINTAGE2D_PAGE_SIZE - kept_height * width,
+			true);
+}
+
+int
+v2d_context_resize(v2d_context_t *ctx, uint16_t width, uint16_t height,
+		bool preserve)
+{
+	int i, old_count = ctx->canvas_pages_count,
+	    count = DIV_ROUND_UP(width * height, VINTAGE2D_PAGE_SIZE);
+	unsigned *page_table = (unsigned *) ctx->canvas_page_table.addr;
+	dma_addr_mapping_t *pages;
+	uint8_t *row = NULL;
+
+	pages = kmalloc(max(old_count, count) * sizeof(dma_addr_mapping_t),
+			GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+	if (preserve) {
+		row = kmalloc(MAX_CANVAS_SIZE, GFP_KERNEL);
+		if (!row) {
+			kfree(pages);
+			return -ENOMEM;
+		}
+	}
+	memcpy(pages, ctx->canvas_pages,
+			old_count * sizeof(dma_addr_mapping_t));
+	for (i = old_count; i < count; ++i)
+		if (dma_addr_mapping_initialize_node(&pages[i], ctx->dev,
+					ctx->node, true))
+			goto outpages;
+
+	v2d_context_unmap(ctx);
+	if (preserve)
+		relayout(pages, max(old_count, count), ctx->width,
+				ctx->height, width, height, row);
+	else
+		for (i = 0; i < min(old_count, count); ++i)
+			memset(pages[i].addr, 0, VINTAGE2D_PAGE_SIZE);
+	for (i = count; i < old_count; ++i) {
+		page_table[i] = 0;
+		dma_addr_mapping_finalize(&pages[i], ctx->dev);
+	}
+	for (i = old_count; i < count; ++i)
+		page_table[i] = VINTAGE2D_PTE_VALID | pages[i].dma_handle;
+
+	kfree(row);
+	kfree(ctx->canvas_pages);
+	ctx->canvas_pages = pages;
+	ctx->canvas_pages_count = count;
+	ctx->width = width;
+	ctx->height = height;
+	memset(ctx->damage, 0, sizeof(ctx->damage));
+	v2d_context_damage(ctx, 0, 0, width, height);
+	return 0;
+outpages:
+	while (i-- > old_count)
+		dma_addr_mapping_finalize(&pages[i], ctx->dev);
+	kfree(row);
+	kfree(pages);
+	return -ENOMEM;
+}
+
+static unsigned
+page_aligned_rows_step(uint16_t width)
+{
+	return VINTAGE2D_PAGE_SIZE / gcd(width, VINTAGE2D_PAGE_SIZE);
+}
+
+unsigned
+v2d_context_combined_height(uint16_t width, uint16_t dst_y, uint16_t src_y,
+		uint16_t height)
+{
+	unsigned step = page_aligned_rows_step(width);
+
+	return roundup(dst_y % step + height, step) + src_y % step + height;
+}
+
+int
+v2d_context_combine(dma_addr_mapping_t *dam, v2d_context_t *dst,
+		uint16_t dst_y, v2d_context_t *src, uint16_t src_y,
+		uint16_t height, unsigned *dst_row, unsigned *src_row)
+{
+	unsigned i, first, count, base,
+		 width = dst->width,
+		 step = page_aligned_rows_step(width);
+	unsigned *page_table;
+
+	if (dma_addr_mapping_initialize(dam, dst->dev))
+		return -ENOMEM;
+	page_table = (unsigned *) dam->addr;
+
+	first = rounddown(dst_y, step) * width / VINTAGE2D_PAGE_SIZE;
+	count = DIV_ROUND_UP((dst_y % step + height) * width,
+			VINTAGE2D_PAGE_SIZE);
+	for (i = 0; i < count; ++i)
+		page_table[i] = VINTAGE2D_PTE_VALID
+			| dst->canvas_pages[first + i].dma_handle;
+	*dst_row = dst_y % step;
+
+	*src_row = roundup(dst_y % step + height, step);
+	base = *src_row * width / VINTAGE2D_PAGE_SIZE;
+	first = rounddown(src_y, step) * width / VINTAGE2D_PAGE_SIZE;
+	count = DIV_ROUND_UP((src_y % step + height) * width,
+			VINTAGE2D_PAGE_SIZE);
+	for (i = 0; i < count; ++i)
+		page_table[base + i] = VINTAGE2D_PTE_VALID
+			| src->canvas_pages[first + i].dma_handle;
+	*src_row += src_y % step;
+	return 0;
+}
+
+static void
+combine_span(unsigned *page_table, unsigned slot, v2d_context_t *ctx,
+		size_t offset, uint16_t width)
+{
+	unsigned i, first = offset / VINTAGE2D_PAGE_SIZE,
+		 count = DIV_ROUND_UP(offset % VINTAGE2D_PAGE_SIZE + width,
+				 VINTAGE2D_PAGE_SIZE);
+
+	for (i = 0; i < count; ++i)
+		page_table[slot + i] = VINTAGE2D_PTE_VALID
+			| ctx->canvas_pages[first + i].dma_handle;
+}
+
+/* A row of at most half a page starting within a page spans at most two. */
+int
+v2d_context_combine_rows(dma_addr_mapping_t *dam, v2d_context_t *dst,
+		size_t dst_offset, v2d_context_t *src, size_t src_offset,
+		uint16_t width, uint16_t rows)
+{
+	unsigned i;
+
+	if (dma_addr_mapping_initialize(dam, dst->dev))
+		return -ENOMEM;
+	for (i = 0; i < rows; ++i) {
+		combine_span((unsigned *) dam->addr, 4 * i, dst,
+				dst_offset + (size_t) i * dst->width, width);
+		combine_span((unsigned *) dam->addr, 4 * i + 2, src,
+				src_offset + (size_t) i * src->width, width);
+	}
+	return 0;
+}
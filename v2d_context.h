@@ -3,11 +3,84 @@
 
 #include "common.h"
 
+/* Unless zero is set, the canvas is left as allocated, to be filled. */
 int
-v2d_context_initialize(v2d_context_t *ctx, uint16_t width, uint16_t height);
+v2d_context_initialize(v2d_context_t *ctx, uint16_t width, uint16_t height,
+		bool zero);
 
 void
 v2d_context_finalize(v2d_context_t *ctx);
 
+/* Pages are reused, and only the difference in their number allocated or
+ * freed. The device must not be using the canvas. */
+int
+v2d_context_resize(v2d_context_t *ctx, uint16_t width, uint16_t height,
+		bool preserve);
+
+/* Clears the part of the last page past the canvas, which the device never
+ * draws to but a mapping shows. */
+void
+v2d_context_clear_tail(v2d_context_t *ctx);
+
+/* Fills the canvas with color on the CPU and clears the rest of it. */
+void
+v2d_context_fill(v2d_context_t *ctx, uint8_t color);
+
+/* Zaps all CPU mappings of the canvas, so that the following accesses fault
+ * in its current pages. */
+void
+v2d_context_unmap(v2d_context_t *ctx);
+
+void
+v2d_context_damage(v2d_context_t *ctx, unsigned x, unsigned y,
+		unsigned width, unsigned height);
+
+/* Pages shared with a snapshot are copied before they are written, either by
+ * the device, in which case it has to be synchronized first, or by the CPU
+ * through a mapping. */
+bool
+v2d_context_rect_shared(v2d_context_t *ctx, unsigned x, unsigned y,
+		unsigned width, unsigned height);
+
+int
+v2d_context_unshare_page(v2d_context_t *ctx, int i);
+
+int
+v2d_context_unshare_rect(v2d_context_t *ctx, unsigned x, unsigned y,
+		unsigned width, unsigned height);
+
+int
+v2d_context_unshare_range(v2d_context_t *ctx, size_t offset, size_t len);
+
+/* Copies len bytes at offset of the canvas from (write) or to buf. */
+void
+v2d_context_access(v2d_context_t *ctx, size_t offset, uint8_t *buf,
+		size_t len, bool write);
+
+/* Canvases are row-linear, so rows of two canvases of the same width can
+ * share one device address space as long as each starts on a row that is
+ * also a page boundary. */
+unsigned
+v2d_context_combined_height(uint16_t width, uint16_t dst_y, uint16_t src_y,
+		uint16_t height);
+
+int
+v2d_context_combine(dma_addr_mapping_t *dam, v2d_context_t *dst,
+		uint16_t dst_y, v2d_context_t *src, uint16_t src_y,
+		uint16_t height, unsigned *dst_row, unsigned *src_row);
+
+/* Where rows of that width never start on a page boundary close enough to
+ * each other, rows are combined one by one instead: row i of a band is mapped
+ * from page 4i for the destination and 4i + 2 for the source of a canvas of
+ * width V2D_COMBINED_ROWS_WIDTH, which divides the page. A row of the band
+ * spans 8 rows of that canvas. */
+#define V2D_COMBINED_ROWS_WIDTH	(VINTAGE2D_PAGE_SIZE / 2)
+#define V2D_COMBINED_ROWS	(VINTAGE2D_PAGE_SIZE / sizeof(unsigned) / 4)
+
+int
+v2d_context_combine_rows(dma_addr_mapping_t *dam, v2d_context_t *dst,
+		size_t dst_offset, v2d_context_t *src, size_t src_offset,
+		uint16_t width, uint16_t rows);
+
 #endif
 
@@ -1,68 +1,101 @@
 #include "v2d_device.h"
 
-void
-v2d_devices_init(v2d_device_t v2d_devices[], int size, int first_minor)
+int
+v2d_devices_init(v2d_devices_t *devices, int size, int first_minor)
 {
-	int i;
+	devices->devices = kcalloc(size, sizeof(v2d_device_t *), GFP_KERNEL);
+	if (!devices->devices)
+		return -1;
+	devices->size = size;
+	devices->first_minor = first_minor;
+	ida_init(&devices->minors);
+	return 0;
+}
 
-	for(i=0; i<size; i++) {
-		mutex_init(&v2d_devices[i].mutex);
-		init_waitqueue_head(&v2d_devices[i].queue);
-		v2d_devices[i].minor = first_minor++;
-		v2d_devices[i].dev = NULL;
-	}
+void
+v2d_devices_finalize(v2d_devices_t *devices)
+{
+	ida_destroy(&devices->minors);
+	kfree(devices->devices);
 }
 
+/* Returns a device holding the driver's reference and a free minor, not yet
+ * visible to v2d_devices_get. */
 v2d_device_t *
-v2d_devices_add(v2d_device_t v2d_devices[], int size, struct pci_dev *dev)
+v2d_devices_add(v2d_devices_t *devices, struct pci_dev *dev)
 {
-	int i;
+	v2d_device_t *v2d_dev;
+	int index;
 
-	for(i=0; i<size; i++) {
-		if (v2d_devices[i].dev == NULL) {
-			v2d_devices[i].dev = dev;
-			return &v2d_devices[i];
-		}
+	v2d_dev = kzalloc_node(sizeof(v2d_device_t), GFP_KERNEL,
+			dev_to_node(&(dev->dev)));
+	if (!v2d_dev)
+		return NULL;
+	index = ida_simple_get(&devices->minors, 0, devices->size, GFP_KERNEL);
+	if (index < 0) {
+		kfree(v2d_dev);
+		return NULL;
 	}
-	return NULL;
+	mutex_init(&v2d_dev->mutex);
+	init_waitqueue_head(&v2d_dev->queue);
+	kref_init(&v2d_dev->kref);
+	v2d_dev->removed = false;
+	v2d_dev->minor = devices->first_minor + index;
+	v2d_dev->dev = pci_dev_get(dev);
+	return v2d_dev;
 }
 
 void
-v2d_devices_del(v2d_device_t v2d_devices[], int size, struct pci_dev *dev)
+v2d_devices_publish(v2d_devices_t *devices, v2d_device_t *v2d_dev)
 {
-	int i;
+	rcu_assign_pointer(devices->devices[v2d_dev->minor
+			- devices->first_minor], v2d_dev);
+}
 
-	for(i=0; i<size; i++) {
-		if (v2d_devices[i].dev == dev) {
-			v2d_devices[i].dev = NULL;
-			return;
-		}
-	}
+/* Later lookups miss the device; ones in progress may still take a
+ * reference. */
+void
+v2d_devices_del(v2d_devices_t *devices, v2d_device_t *v2d_dev)
+{
+	RCU_INIT_POINTER(devices->devices[v2d_dev->minor
+			- devices->first_minor], NULL);
 }
 
+/* Returns the device with a reference, or NULL if there is none or it is
+ * being freed. */
 v2d_device_t *
-v2d_devices_by_minor(v2d_device_t v2d_devices[], int size, int minor)
+v2d_devices_get(v2d_devices_t *devices, int minor)
 {
-	int i;
+	v2d_device_t *v2d_dev;
+	int index = minor - devices->first_minor;
 
-	for(i=0; i<size; i++) {
-		if (v2d_devices[i].minor == minor) {
-			return &v2d_devices[i];
-		}
-	}
-	return NULL;
+	if (index < 0 || index >= devices->size)
+		return NULL;
+	rcu_read_lock();
+	v2d_dev = rcu_dereference(devices->devices[index]);
+	if (v2d_dev && !kref_get_unless_zero(&v2d_dev->kref))
+		v2d_dev = NULL;
+	rcu_read_unlock();
+	return v2d_dev;
 }
 
-v2d_device_t *
-v2d_devices_by_dev(v2d_device_t v2d_devices[], int size, struct pci_dev *dev)
+static void
+v2d_device_release(struct kref *kref)
 {
-	int i;
+	v2d_device_t *v2d_dev = container_of(kref, v2d_device_t, kref);
 
-	for(i=0; i<size; i++) {
-		if (v2d_devices[i].dev == dev) {
-			return &v2d_devices[i];
-		}
-	}
-	return NULL;
+	/* Contexts have debugfs files in the directory until they go. */
+	debugfs_remove_recursive(v2d_dev->debugfs);
+	pci_dev_put(v2d_dev->dev);
+	kfree_rcu(v2d_dev, rcu);
 }
 
+/* The minor is reused only once the last context of the device is gone. */
+void
+v2d_devices_put(v2d_devices_t *devices, v2d_device_t *v2d_dev)
+{
+	int index = v2d_dev->minor - devices->first_minor;
+
+	if (kref_put(&v2d_dev->kref, v2d_device_release))
+		ida_simple_remove(&devices->minors, index);
+}
@@ -3,20 +3,35 @@
 
 #include "common.h"
 
+/* Devices indexed by minor. Lookups take no lock; probe and removal publish
+ * and clear entries, and a device is freed after the last reference is put
+ * and a grace period has passed. */
+typedef struct {
+	v2d_device_t __rcu **devices;
+	int size;
+	int first_minor;
+	struct ida minors;
+} v2d_devices_t;
+
+int
+v2d_devices_init(v2d_devices_t *devices, int size, int first_minor);
+
 void
-v2d_devices_init(v2d_device_t v2d_devices[], int size, int first_minor);
+v2d_devices_finalize(v2d_devices_t *devices);
 
 v2d_device_t *
-v2d_devices_add(v2d_device_t v2d_devices[], int size, struct pci_dev *dev);
+v2d_devices_add(v2d_devices_t *devices, struct pci_dev *dev);
 
 void
-v2d_devices_del(v2d_device_t v2d_devices[], int size, struct pci_dev *dev);
+v2d_devices_publish(v2d_devices_t *devices, v2d_device_t *v2d_dev);
 
-v2d_device_t *
-v2d_devices_by_minor(v2d_device_t v2d_devices[], int size, int minor);
+void
+v2d_devices_del(v2d_devices_t *devices, v2d_device_t *v2d_dev);
 
 v2d_device_t *
-v2d_devices_by_dev(v2d_device_t v2d_devices[], int size, struct pci_dev *dev);
+v2d_devices_get(v2d_devices_t *devices, int minor);
 
-#endif
+void
+v2d_devices_put(v2d_devices_t *devices, v2d_device_t *v2d_dev);
 
+#endif
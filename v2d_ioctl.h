@@ -15,6 +15,114 @@ struct v2d_ioctl_set_dimensions {
 };
 #define V2D_IOCTL_SET_DIMENSIONS _IOW('2', 0x00, struct v2d_ioctl_set_dimensions)
 
+/* Blit from the canvas of another context of the same device, given by an
+ * open descriptor. The canvases may have different widths. */
+struct v2d_ioctl_blit_from {
+	int32_t src_fd;
+	uint16_t src_x;
+	uint16_t src_y;
+	uint16_t dst_x;
+	uint16_t dst_y;
+	uint16_t width;
+	uint16_t height;
+};
+#define V2D_IOCTL_BLIT_FROM _IOW('2', 0x01, struct v2d_ioctl_blit_from)
+
+/* Synchronize like fsync, then return and clear the damage done by DO_FILL
+ * and DO_BLIT since the previous query. Bit x of rows[y] is set if the tile
+ * of pixels [x, x + 1) * TILE_SIZE by [y, y + 1) * TILE_SIZE was drawn. */
+#define V2D_DAMAGE_TILE_SIZE		64
+#define V2D_DAMAGE_TILES		(2048 / V2D_DAMAGE_TILE_SIZE)
+struct v2d_ioctl_damage {
+	uint32_t rows[V2D_DAMAGE_TILES];
+};
+#define V2D_IOCTL_FSYNC_DAMAGE _IOR('2', 0x02, struct v2d_ioctl_damage)
+
+/* Return a new descriptor of a read-only, mmapable snapshot of the canvas.
+ * Pages are shared with the canvas until either is written. Only one
+ * snapshot of a context may exist at a time. */
+#define V2D_IOCTL_SNAPSHOT _IO('2', 0x03)
+
+/* TLB statistics of the context: estimated misses of the submitted draws and
+ * observed changes of the device TLB tags. By default the tags are sampled
+ * once after each submission, which sees at most two changes per draw and is
+ * no miss count. With the tlb_poll module parameter each draw is waited for
+ * while polling the tags, and sampled_misses counts the actual misses, less
+ * any page held for shorter than one poll. */
+struct v2d_ioctl_tlb_stats {
+	uint32_t draws;
+	uint32_t split_draws;
+	uint32_t estimated_misses;
+	uint32_t sampled_misses;
+};
+#define V2D_IOCTL_TLB_STATS _IOR('2', 0x04, struct v2d_ioctl_tlb_stats)
+
+/* Fill the destination rectangle by repeating the tile, which is already in
+ * the canvas and either lies outside the destination or at its origin. */
+struct v2d_ioctl_pattern_fill {
+	uint16_t src_x;
+	uint16_t src_y;
+	uint16_t tile_width;
+	uint16_t tile_height;
+	uint16_t dst_x;
+	uint16_t dst_y;
+	uint16_t width;
+	uint16_t height;
+};
+#define V2D_IOCTL_PATTERN_FILL _IOW('2', 0x05, struct v2d_ioctl_pattern_fill)
+
+/* Record accepted commands, ioctls and fsyncs of the context into a ring of
+ * the given number of entries, readable from debugfs. Zero entries stop the
+ * recording and drop the ring. */
+struct v2d_ioctl_capture {
+	uint32_t entries;
+};
+#define V2D_IOCTL_CAPTURE _IOW('2', 0x06, struct v2d_ioctl_capture)
+#define V2D_CAPTURE_MAX_ENTRIES (1 << 20)
+
+/* Change the dimensions of an existing canvas, keeping the pixels of the
+ * common top-left rectangle with V2D_RESIZE_PRESERVE, or clearing all of it
+ * otherwise. Existing mappings of the canvas must be faulted in again. Fails
+ * with EBUSY while the canvas has a snapshot. */
+struct v2d_ioctl_resize {
+	uint16_t height;
+	uint16_t width;
+	uint32_t flags;
+};
+#define V2D_IOCTL_RESIZE _IOW('2', 0x07, struct v2d_ioctl_resize)
+#define V2D_RESIZE_PRESERVE 1
+
+/* The NUMA node canvas pages are allocated on, -1 for the node of the device,
+ * which is the default. It can only be set before the canvas is created. Get
+ * also returns how many of the canvas pages are on the node; for a device
+ * outside any node it returns the node of the first page, or of the calling
+ * CPU before the canvas exists. */
+struct v2d_ioctl_node {
+	int32_t node;
+	uint32_t pages;
+	uint32_t node_pages;
+};
+#define V2D_IOCTL_SET_NODE _IOW('2', 0x08, struct v2d_ioctl_node)
+#define V2D_IOCTL_GET_NODE _IOR('2', 0x09, struct v2d_ioctl_node)
+
+/* As SET_DIMENSIONS, but the canvas is filled with color by the device, with
+ * the first command of the context, instead of cleared by the driver. Draws
+ * follow the fill and CPU accesses through a mapping wait for it. On x86
+ * dma_alloc_coherent clears the pages itself, so no CPU pass is saved unless
+ * SET_NODE has put the canvas on another node than the device. */
+struct v2d_ioctl_set_dimensions_fill {
+	uint16_t height;
+	uint16_t width;
+	uint8_t color;
+	uint8_t pad[3];
+};
+#define V2D_IOCTL_SET_DIMENSIONS_FILL _IOW('2', 0x0a, struct v2d_ioctl_set_dimensions_fill)
+
+/* Returns a new descriptor of the pixels of the canvas, width * height bytes
+ * of rows, for read, write, pread, pwrite and splice. Reads and writes are
+ * ordered after the commands written to the context before them. */
+#define V2D_IOCTL_CANVAS_FD _IO('2', 0x0b)
+
 /* Commands */
 
 #define V2D_CMD_TYPE(cmd)		((cmd) & 0xff)
@@ -0,0 +1,43 @@
+#include "v2d_context.h"
+#include "v2d_snapshot.h"
+
+int
+v2d_snapshot_initialize(v2d_snapshot_t *snap, v2d_context_t *ctx)
+{
+	snap->canvas_pages = kmalloc(
+			ctx->canvas_pages_count * sizeof(dma_addr_mapping_t),
+			GFP_KERNEL);
+	if (!snap->canvas_pages)
+		return -ENOMEM;
+	ctx->shared = kcalloc(BITS_TO_LONGS(ctx->canvas_pages_count),
+			sizeof(unsigned long), GFP_KERNEL);
+	if (!ctx->shared) {
+		kfree(snap->canvas_pages);
+		return -ENOMEM;
+	}
+
+	snap->ctx = ctx;
+	snap->canvas_pages_count = ctx->canvas_pages_count;
+	memcpy(snap->canvas_pages, ctx->canvas_pages,
+			ctx->canvas_pages_count * sizeof(dma_addr_mapping_t));
+	bitmap_fill(ctx->shared, ctx->canvas_pages_count);
+	ctx->snapshot = snap;
+	v2d_context_unmap(ctx);
+	return 0;
+}
+
+void
+v2d_snapshot_finalize(v2d_snapshot_t *snap)
+{
+	v2d_context_t *ctx = snap->ctx;
+	int i;
+
+	for (i = 0; i < snap->canvas_pages_count; ++i)
+		if (!test_bit(i, ctx->shared))
+			dma_addr_mapping_finalize(&snap->canvas_pages[i],
+					ctx->dev);
+	kfree(snap->canvas_pages);
+	kfree(ctx->shared);
+	ctx->shared = NULL;
+	ctx->snapshot = NULL;
+}
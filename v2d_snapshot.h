@@ -0,0 +1,12 @@
+#ifndef V2D_SNAPSHOT_H
+#define V2D_SNAPSHOT_H
+
+#include "common.h"
+
+int
+v2d_snapshot_initialize(v2d_snapshot_t *snap, v2d_context_t *ctx);
+
+void
+v2d_snapshot_finalize(v2d_snapshot_t *snap);
+
+#endif
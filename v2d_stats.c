@@ -0,0 +1,73 @@
+#include "v2d_stats.h"
+
+static const char *cmd_names[V2D_STATS_CMD_TYPES] = {
+	"canvas_pt", "canvas_dims", "src_pos", "dst_pos",
+	"fill_color", "do_blit", "do_fill", "counter"
+};
+
+static const char *error_names[V2D_STATS_ERRORS] = {
+	"invalid_cmd", "page_fault", "canvas_overflow", "fifo_overflow"
+};
+
+void
+v2d_stats_cmd(v2d_stats_t *stats, unsigned cmd)
+{
+	unsigned pixels = VINTAGE2D_CMD_WIDTH(cmd) * VINTAGE2D_CMD_HEIGHT(cmd);
+
+	++stats->cmds[VINTAGE2D_CMD_TYPE(cmd) >> 2];
+	switch (VINTAGE2D_CMD_TYPE(cmd)) {
+	case VINTAGE2D_CMD_TYPE_DO_FILL:
+		stats->bytes += pixels;
+		break;
+	case VINTAGE2D_CMD_TYPE_DO_BLIT:
+		stats->bytes += 2 * pixels;
+		break;
+	}
+}
+
+void
+v2d_stats_sync(v2d_stats_t *stats, u64 ns)
+{
+	++stats->sync_us[min(fls64(div_u64(ns, NSEC_PER_USEC)),
+			V2D_STATS_SYNC_BUCKETS - 1)];
+}
+
+static int
+v2d_stats_show(struct seq_file *s, void *unused)
+{
+	v2d_stats_t *stats = s->private;
+	int i;
+
+	for (i = 0; i < V2D_STATS_CMD_TYPES; ++i)
+		seq_printf(s, "cmds_%s %llu\n", cmd_names[i], stats->cmds[i]);
+	seq_printf(s, "bytes %llu\n", stats->bytes);
+	seq_printf(s, "context_switches %llu\n", stats->context_switches);
+	seq_printf(s, "ring_full %llu\n", stats->ring_full);
+	seq_printf(s, "ring_wait_ns %llu\n", stats->ring_wait_ns);
+	seq_printf(s, "irqs %llu\n", stats->irqs);
+	for (i = 0; i < V2D_STATS_ERRORS; ++i)
+		seq_printf(s, "errors_%s %llu\n", error_names[i],
+				stats->errors[i]);
+	seq_printf(s, "recoveries %llu\n", stats->recoveries);
+	/* Bucket i counts syncs that took less than 2^i microseconds and at
+	 * least as long as those in the previous one; the last one also counts
+	 * all the longer ones. */
+	for (i = 0; i < V2D_STATS_SYNC_BUCKETS; ++i)
+		seq_printf(s, "sync_us_lt_%u %llu\n", 1u << i,
+				stats->sync_us[i]);
+	return 0;
+}
+
+static int
+v2d_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, v2d_stats_show, inode->i_private);
+}
+
+const struct file_operations v2d_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= v2d_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release
+};
@@ -0,0 +1,14 @@
+#ifndef V2D_STATS_H
+#define V2D_STATS_H
+
+#include "common.h"
+
+extern const struct file_operations v2d_stats_fops;
+
+void
+v2d_stats_cmd(v2d_stats_t *stats, unsigned cmd);
+
+void
+v2d_stats_sync(v2d_stats_t *stats, u64 ns);
+
+#endif
@@ -0,0 +1,106 @@
+#include "v2d_tlb.h"
+
+static unsigned
+walk_misses(uint16_t canvas_width, unsigned x, unsigned y, unsigned width,
+		unsigned height, bool up, bool left)
+{
+	unsigned misses = 0, i, row, first, last, page;
+	long tag = -1;
+
+	for (i = 0; i < height; ++i) {
+		row = up ? y + height - 1 - i : y + i;
+		first = (row * canvas_width + x) / VINTAGE2D_PAGE_SIZE;
+		last = (row * canvas_width + x + width - 1)
+			/ VINTAGE2D_PAGE_SIZE;
+		for (page = first; page <= last; ++page)
+			if (tag != (left ? first + last - page : page)) {
+				tag = left ? first + last - page : page;
+				++misses;
+			}
+	}
+	return misses;
+}
+
+static bool
+overlap(unsigned src_x, unsigned src_y, unsigned dst_x, unsigned dst_y,
+		unsigned width, unsigned height)
+{
+	return src_x < dst_x + width && dst_x < src_x + width
+		&& src_y < dst_y + height && dst_y < src_y + height;
+}
+
+unsigned
+v2d_tlb_fill_misses(uint16_t canvas_width, unsigned x, unsigned y,
+		unsigned width, unsigned height)
+{
+	return walk_misses(canvas_width, x, y, width, height, false, false);
+}
+
+unsigned
+v2d_tlb_blit_misses(uint16_t canvas_width, unsigned src_x, unsigned src_y,
+		unsigned dst_x, unsigned dst_y, unsigned width,
+		unsigned height)
+{
+	bool reverse = overlap(src_x, src_y, dst_x, dst_y, width, height),
+	     up = reverse && dst_y > src_y,
+	     left = reverse && dst_y == src_y && dst_x > src_x;
+
+	return walk_misses(canvas_width, src_x, src_y, width, height,
+			up, left)
+		+ walk_misses(canvas_width, dst_x, dst_y, width, height,
+			up, left);
+}
+
+/* Returns the number of bands, in the order they have to be drawn, or 0 if
+ * splitting is not expected to halve the misses. */
+int
+v2d_tlb_split_blit(uint16_t canvas_width, unsigned src_x, unsigned src_y,
+		unsigned dst_x, unsigned dst_y, unsigned width,
+		unsigned height, v2d_tlb_band_t bands[V2D_TLB_MAX_BANDS])
+{
+	unsigned step, done, size, misses = 0;
+	int count = 0;
+	bool rows;
+
+	if (!overlap(src_x, src_y, dst_x, dst_y, width, height))
+		return 0;
+	if (dst_y > src_y) {
+		rows = true;
+		step = dst_y - src_y;
+	} else if (dst_y == src_y && dst_x > src_x) {
+		rows = false;
+		step = dst_x - src_x;
+	} else {
+		return 0;
+	}
+	if (DIV_ROUND_UP(rows ? height : width, step) > V2D_TLB_MAX_BANDS)
+		return 0;
+
+	for (done = 0; done < (rows ? height : width); done += size) {
+		size = min(step, (rows ? height : width) - done);
+		if (rows) {
+			bands[count].src_x = src_x;
+			bands[count].dst_x = dst_x;
+			bands[count].src_y = src_y + height - done - size;
+			bands[count].dst_y = dst_y + height - done - size;
+			bands[count].width = width;
+			bands[count].height = size;
+		} else {
+			bands[count].src_x = src_x + width - done - size;
+			bands[count].dst_x = dst_x + width - done - size;
+			bands[count].src_y = src_y;
+			bands[count].dst_y = dst_y;
+			bands[count].width = size;
+			bands[count].height = height;
+		}
+		misses += v2d_tlb_blit_misses(canvas_width,
+				bands[count].src_x, bands[count].src_y,
+				bands[count].dst_x, bands[count].dst_y,
+				bands[count].width, bands[count].height);
+		++count;
+	}
+	if (2 * misses > v2d_tlb_blit_misses(canvas_width, src_x, src_y,
+				dst_x, dst_y, width, height))
+		return 0;
+	return count;
+}
@@ -0,0 +1,32 @@
+#ifndef V2D_TLB_H
+#define V2D_TLB_H
+
+#include "common.h"
+
+/* The device walks a rectangle line by line with a single-entry TLB for each
+ * of the source and the destination. Assuming it reverses the direction of a
+ * blit only when the source and the destination overlap, these estimate the
+ * misses of a single DO_FILL or DO_BLIT and choose how to split a blit into
+ * bands without overlap, which are walked forward. */
+
+#define V2D_TLB_MAX_BANDS 16
+
+typedef struct {
+	unsigned src_x, src_y, dst_x, dst_y, width, height;
+} v2d_tlb_band_t;
+
+unsigned
+v2d_tlb_fill_misses(uint16_t canvas_width, unsigned x, unsigned y,
+		unsigned width, unsigned height);
+
+unsigned
+v2d_tlb_blit_misses(uint16_t canvas_width, unsigned src_x, unsigned src_y,
+		unsigned dst_x, unsigned dst_y, unsigned width,
+		unsigned height);
+
+int
+v2d_tlb_split_blit(uint16_t canvas_width, unsigned src_x, unsigned src_y,
+		unsigned dst_x, unsigned dst_y, unsigned width,
+		unsigned height, v2d_tlb_band_t bands[V2D_TLB_MAX_BANDS]);
+
+#endif
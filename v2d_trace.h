@@ -0,0 +1,118 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM v2d
+
+#if !defined(V2D_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define V2D_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(v2d_submit,
+	TP_PROTO(int minor, unsigned cmd),
+	TP_ARGS(minor, cmd),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(unsigned, cmd)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->cmd = cmd;
+	),
+	TP_printk("v2d%d cmd=%08x", __entry->minor, __entry->cmd)
+);
+
+TRACE_EVENT(v2d_set_context,
+	TP_PROTO(int minor, void *ctx),
+	TP_ARGS(minor, ctx),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(void *, ctx)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->ctx = ctx;
+	),
+	TP_printk("v2d%d ctx=%p", __entry->minor, __entry->ctx)
+);
+
+TRACE_EVENT(v2d_sync_start,
+	TP_PROTO(int minor, unsigned marker),
+	TP_ARGS(minor, marker),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(unsigned, marker)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->marker = marker;
+	),
+	TP_printk("v2d%d marker=%u", __entry->minor, __entry->marker)
+);
+
+TRACE_EVENT(v2d_sync_end,
+	TP_PROTO(int minor, u64 ns),
+	TP_ARGS(minor, ns),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->ns = ns;
+	),
+	TP_printk("v2d%d ns=%llu", __entry->minor,
+		(unsigned long long) __entry->ns)
+);
+
+TRACE_EVENT(v2d_ring_full,
+	TP_PROTO(int minor, u64 ns),
+	TP_ARGS(minor, ns),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->ns = ns;
+	),
+	TP_printk("v2d%d waited ns=%llu", __entry->minor,
+		(unsigned long long) __entry->ns)
+);
+
+TRACE_EVENT(v2d_irq,
+	TP_PROTO(int minor, unsigned intr),
+	TP_ARGS(minor, intr),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(unsigned, intr)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->intr = intr;
+	),
+	TP_printk("v2d%d intr=%02x", __entry->minor, __entry->intr)
+);
+
+TRACE_EVENT(v2d_recover,
+	TP_PROTO(int minor, unsigned intr, void *ctx),
+	TP_ARGS(minor, intr, ctx),
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(unsigned, intr)
+		__field(void *, ctx)
+	),
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->intr = intr;
+		__entry->ctx = ctx;
+	),
+	TP_printk("v2d%d intr=%02x ctx=%p", __entry->minor, __entry->intr,
+		__entry->ctx)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE v2d_trace
+#include <trace/define_trace.h>